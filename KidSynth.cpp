@@ -2,70 +2,51 @@
 
 using namespace daisy;
 using namespace daisy::seed;
-#include "daisysp.h"
-#include <cstdlib>  // for rand() and srand()
+#include "synth_engine.h"
+#include "audio_config.h"
+#include "control_scanner.h"
+#include "entropy_pool.h"
+#include "gesture_recorder.h"
+#include "memory_placement.h"
+#include "pattern.h"
+#include "pattern_bank.h"
+#include "pitch.h"
+#include "trace.h"
 
 // Create out Daisy Seed Hardware object
 DaisySeed hw;
-daisysp::Oscillator osc;
-daisysp::Oscillator osc2;
-daisysp::Oscillator osc3;  // Sub-bass oscillator for third waveform mode
-daisysp::Oscillator lfo;
-daisysp::Svf filter;
-daisysp::DcBlock dcblock;
-
-enum EnvState {
-  ENV_IDLE,
-  ENV_ATTACK,
-  ENV_SUSTAIN,
-  ENV_RELEASE
-};
-
-EnvState env_state = ENV_IDLE;
-float env = 0.0f;
-
-// Knob setups
-AnalogControl tempo_knob;
-Parameter tempo_param;
-float cutoff = 1000.0f;
-float resonance = 0.1f;
-float osc_mod_amount = 0.0f;
-float attack_mod_amount = 0.0f;  // Attack time modulation from joystick
-float max_cutoff = 12000.0f;  // Increased for more high-end range
-float min_cutoff = 100.0f;    // Decreased for deeper bass
-float cutoff_target = 1000.0f;
-float cutoff_smooth = 1000.0f;
-
-// Pitch bend from soft pot gesture
-float pitch_bend_amount = 0.0f;  // in semitones, +/- 24 (2 octaves)
 
-// Envelope paramaters
-// Attack/Release are hardcoded, sustain is always at 1
-// You can adjust sustain time to fill the rest of the step.
-float attack_time = 0.01f;   // Shorter for punchier notes
-float release_time = 0.08f;  // Slightly longer for smoother tail
-float step_length_samples = 0.0f; 
-float sustain_samples = 0.0f;
-float sustain_counter = 0.0f;
+// The sound engine, fed from the controls below. Its state is touched every
+// sample, so it lives in DTCM.
+KidSynth KIDSYNTH_DTCM_BSS synth;
 
-int bitcrush_counter = 0;
-float bitcrush_lp = 0.0f;
+// The delay line's memory: too big for internal SRAM, so it goes in SDRAM,
+// which hw.Init() brings up before the engine is initialized
+int16_t KIDSYNTH_SDRAM_BSS delay_memory[KidSynth::DELAY_BUFFER_SIZE];
 
-AnalogControl cutoff_knob;
-Parameter cutoff_param;
-Parameter resonance_param;
+// UpdateControls() runs about once per millisecond; the timers below count
+// the milliseconds that actually went by
+constexpr float CONTROL_RATE = 1000.0f;
+uint32_t last_control_ms = 0;
+uint32_t control_elapsed_ms = 0;
 
-AnalogControl osc_mod_knob;
-Parameter osc_mod_param;
-
-AnalogControl attack_mod_knob;
-Parameter attack_mod_param;
-
-AnalogControl sustain_knob;
-Parameter sustain_param;
+enum AdcChannel {
+  tempo = 0,
+  filter_cutoff,
+  osc_mod,
+  sustain,
+  attack_mod,
+  cutoff_slider,
+  NUM_ADC_CHANNELS
+};
 
-AnalogControl cutoff_mod_slider;
-Parameter cutoff_mod_slider_param;
+// Knob setups. The knobs and soft pot are scanned together, and each Update
+// function below only acts when its control has moved. Every control tick
+// reads the ADC once, into adc_snapshot, so all of it sees the same readings.
+KnobScanner<NUM_ADC_CHANNELS> knobs;
+uint16_t adc_snapshot[NUM_ADC_CHANNELS];
+float max_cutoff = 12000.0f;  // Increased for more high-end range
+float min_cutoff = 100.0f;    // Decreased for deeper bass
 
 // Button setups
 Switch delay_button;
@@ -82,9 +63,8 @@ bool bitcrush_enabled = false;
 
 Switch waveform_button;
 GPIO waveform_led;
-int waveform = daisysp::Oscillator::WAVE_SAW; // Init as SAW
+KidSynth::WaveformMode waveform_mode = KidSynth::WAVEFORM_SAW; // Init as SAW
 int waveform_led_timer = 0;
-bool waveform_mixed_mode = false;  // Third mode: saw + square mix
 
 Switch sequence_button;
 GPIO sequence_led;
@@ -92,7 +72,6 @@ int sequence_led_timer = 0;
 
 Switch swing_button;
 bool is_swing = false;
-float swing_amount = 0.5;
 
 // Master volume toggle (50% when enabled)
 bool half_volume_enabled = false;
@@ -100,57 +79,80 @@ int volume_hold_ms = 0;
 bool volume_hold_triggered = false;
 
 constexpr int LED_PULSE_MS = 150;
+constexpr int SAVE_LED_MS = 600;
+
+// New patterns are composed ahead of time in the main loop, so the sequence
+// button only has to hand the next one to the engine
+constexpr int NUM_READY_PATTERNS = 4;
+EntropyPool entropy;
+PatternGenerator pattern_generator;
+Pattern ready_patterns[NUM_READY_PATTERNS];  // FIFO, so bassline and melody still alternate
+int ready_first = 0;
+int ready_count = 0;
+int pattern_length = Pattern::DEFAULT_STEPS;  // Of the patterns composed from now on
+// The engine plays the newest pattern queued from the next bar, so the one
+// queued last is playing once the engine has taken everything queued
+Pattern queued_pattern;           // The one queued last
+bool pattern_in_flight = false;   // queued_pattern has yet to start
+Pattern playing_pattern;          // Which saving stores; length 0 until one plays
+
+// Saved patterns, in the top 64KB of the QSPI flash, clear of the program
+// when the Daisy bootloader runs it from there
+constexpr uint32_t PATTERN_BANK_OFFSET = 0x7f0000;
+PatternBank pattern_bank;
+int recall_index = 0;   // Song position of the pattern recalled or saved last
+bool song_mode = false;  // Playing the saved patterns in turn, a bar each
+int song_index = 0;      // Song position to queue next
+
+// A tap on the sequence button acts on release; holding it saves, and it
+// is held as a shift for the recall and song buttons
+constexpr int SAVE_HOLD_MS = 1000;
+int sequence_hold_ms = 0;
+bool sequence_hold_used = false;  // Saved or shifted; the release does nothing
+
+// Audio callback CPU statistics, refreshed once a second from the main loop.
+// Watch it from the debugger; USB logging is too disruptive to print it.
+ProfileStats cpu_stats;
+int cpu_stats_ms = 0;
+
+// When the last audio callback started, to timestamp control changes
+volatile uint32_t callback_us = 0;
+// Sample time of this round of control changes, see ControlTime(), and the
+// microsecond clock when it started
+uint32_t control_time = 0;
+uint32_t control_us = 0;
+
+// The buttons in the order the trace and the control recording number them
+enum ButtonId {
+  BUTTON_DELAY,
+  BUTTON_DOUBLE_TEMPO,
+  BUTTON_BITCRUSH,
+  BUTTON_WAVEFORM,
+  BUTTON_SEQUENCE,
+  BUTTON_SWING,
+  NUM_BUTTONS
+};
+Switch* const button_switches[NUM_BUTTONS] = {
+  &delay_button, &double_tempo_button, &bitcrush_button, &waveform_button, &sequence_button, &swing_button,
+};
 
-// Setup delay
-constexpr size_t MAX_DELAY = 96000;
-daisysp::DelayLine<float, MAX_DELAY> delay;
-
-// Delay state
-float delay_target = 16000.0f;  // Medium delay time - more audible at slow tempos
-float delay_smooth = 16000.0f;
-float feedback = 0.2f;
-float mix = 0.42f;  // Balanced wet mix for presence without muddiness
-
-//Step timing (the clock)
-float phase = 0.0f;
-
-//Tempo smoothing
-float bpm_target = 120.0f;
-float bpm_smooth = 120.0f;
-float steps_per_beat = 2.0f;
-
-constexpr int NUM_STEPS = 8;
-float step_freqs[NUM_STEPS];
-bool step_is_rest[NUM_STEPS];  // Track which steps are silent
-float step_velocity[NUM_STEPS];  // Volume per step (0.5 - 1.0)
-int current_step = 0;
-
-// Base frequency of the current step (without pitch bend)
-float current_base_freq = 0.0f;
-
-constexpr int MAJOR_SCALE[7] = {0, 2, 4, 5, 7, 9, 11};
-constexpr int MINOR_SCALE[7] = {0, 2, 3, 5, 7, 8, 10};
-constexpr int degree_weights[7] = {3, 1, 2, 1, 3, 1, 1}; // Bias towards, 1, 3, 5
+// Button presses and releases go in their own trace ring alongside the
+// engine's (trace.h); the main loop sends both over USB
+TraceBuffer<64> control_trace;
 
-int key_root;
-bool is_major;
-bool is_bassline = false; // Sequence will alternate between a bassline and melody
+bool ReadControlTrace(TraceRecord& record) { return control_trace.Read(record); }
 
-// LFO modulation range
-float lfo_freq = 0.2f;
-float lfo_cutoff_mod = 200.0f;
+#if KIDSYNTH_RECORD
+// Every control tick from power-up until it fills, ten minutes or more, for
+// replaying on the host (gesture_recorder.h). Copy it out with the
+// debugger, see README.md.
+constexpr size_t GESTURE_MEMORY_SIZE = 8 * 1024 * 1024;
+uint8_t KIDSYNTH_SDRAM_BSS gesture_memory[GESTURE_MEMORY_SIZE];
+GestureRecorder gestures;
+#endif
 
-enum AdcChannel {
-  tempo = 0,
-  filter_cutoff,
-  osc_mod,
-  sustain,
-  attack_mod,
-  cutoff_slider,
-  NUM_ADC_CHANNELS
-};
-
-// Helper to generate a fairly unique random seed from raw ADC noise
+// Helper to generate a fairly unique random seed from raw ADC noise. Blocks
+// for 16ms, so only used at boot.
 uint32_t GenerateRandomSeed()
 {
   uint32_t seed = System::GetNow();
@@ -174,421 +176,351 @@ uint32_t GenerateRandomSeed()
   return seed;
 }
 
-// AUDIO FUNCTIONS //
-
-// Update all oscillators' frequencies based on a base frequency
-void UpdateOscFrequencies(float base_freq) {
-  osc.SetFreq(base_freq);
-
-  float detune_ratio = 1.005f;  // 0.5% detune for subtle beating/chorus
-  if (osc_mod_amount > 0.0f) {
-    osc2.SetFreq(base_freq * 1.5f * detune_ratio);  // Perfect fifth up + detune
-  } else if (osc_mod_amount < 0.0f) {
-    osc2.SetFreq(base_freq * (2.0f/3.0f) / detune_ratio);  // Perfect fifth down + detune
-  } else {
-    osc2.SetFreq(base_freq * detune_ratio);  // Unison + slight detune
+// Stir the ADC noise and timer jitter into the entropy pool; cheap enough
+// to run every millisecond
+void GatherEntropy() {
+  for(int ch = 0; ch < NUM_ADC_CHANNELS; ch++)
+  {
+    entropy.Add(adc_snapshot[ch]);
   }
-
-  // Sub-bass oscillator one octave down
-  osc3.SetFreq(base_freq * 0.5f);
+  entropy.Add(control_us);
 }
 
-void UpdateEnvelope() {
-switch (env_state) {
-  case ENV_IDLE:
-    env = 0.0f;
-    break;
-
-  case ENV_ATTACK: {
-    // Modulate attack time based on joystick (positive): fast (0.001s) to slow (0.15s)
-    float attack_modulated = attack_time;
-    if (attack_mod_amount > 0.0f) {
-      attack_modulated = attack_time + (attack_mod_amount * 0.14f);
-      attack_modulated = fminf(attack_modulated, 0.15f);
-    }
-    env += 1.0f / (attack_modulated * hw.AudioSampleRate());
-    if (env >= 1.0f) {
-      env = 1.0f;
-      env_state = ENV_SUSTAIN;
-      sustain_counter = 0.0f;
-    }
-    break;
+// Compose one pattern if there is room, each from a fresh seed
+void RefillPatterns() {
+  if(ready_count < NUM_READY_PATTERNS) {
+    pattern_generator.Seed(entropy.Take());
+    pattern_generator.Generate(ready_patterns[(ready_first + ready_count) % NUM_READY_PATTERNS], pattern_length);
+    ready_count++;
   }
+}
 
-  case ENV_SUSTAIN:
-    env = 1.0f;
-    sustain_counter += 1.0f;
-    if (sustain_counter >= sustain_samples) {
-      env_state = ENV_RELEASE;
-    }
-    break;
-
-  case ENV_RELEASE: {
-    // Modulate release time based on joystick (negative): fast (0.08s) to slow (0.5s)
-    float release_modulated = release_time;
-    if (attack_mod_amount < 0.0f) {
-      release_modulated = release_time + (fabs(attack_mod_amount) * 0.42f);
-      release_modulated = fminf(release_modulated, 0.5f);
-    }
-    env -= 1.0f / (release_modulated * hw.AudioSampleRate());
-    if(env <= 0.0f) {
-      env = 0.0f;
-      env_state = ENV_IDLE;
-    }
-    break;
-  }
+// Hand pattern to the engine, keeping a copy to know what plays once it
+// starts. Returns false if the engine's queue is full.
+bool QueuePattern(const Pattern& pattern) {
+  if(!synth.QueuePattern(pattern)) {
+    return false;
   }
+  queued_pattern = pattern;
+  pattern_in_flight = true;
+  return true;
 }
 
-void ResetPhaseCycle() {
-  phase = 0;
-  current_step = (current_step + 1) % NUM_STEPS;
-  
-  // Only trigger envelope if step is not a rest
-  if (!step_is_rest[current_step]) {
-    // Store the un-bent base frequency for this step
-    current_base_freq = step_freqs[current_step];
-
-    // Apply pitch bend (convert semitones to frequency ratio)
-    float bend_ratio = powf(2.0f, pitch_bend_amount / 12.0f);
-    float bent_freq = current_base_freq * bend_ratio;
-
-    // Update oscillator frequencies with pitch bend applied
-    UpdateOscFrequencies(bent_freq);
+void TrackPlayingPattern() {
+  if(pattern_in_flight && !synth.PatternPending()) {
+    playing_pattern = queued_pattern;
+    pattern_in_flight = false;
+  }
+}
 
-    //retriger the envelope
-    env_state = ENV_ATTACK;
+// Queue the oldest ready pattern in the engine. Returns false if none is
+// ready or the engine's queue is full.
+bool SubmitPattern() {
+  if(ready_count == 0 || !QueuePattern(ready_patterns[ready_first])) {
+    return false;
   }
+  ready_first = (ready_first + 1) % NUM_READY_PATTERNS;
+  ready_count--;
+  return true;
 }
 
-void UpdateClock() {
-  //Update the clock, smoothly
-  bpm_smooth += 0.001f * (bpm_target - bpm_smooth);
-  
-  // Smooth bpm changes to avoid clicks
-  step_length_samples = hw.AudioSampleRate() / ((bpm_smooth / 60.0f) * steps_per_beat); 
+// INIT FUNCTIONS //
 
-  // Apply swing to the phase
-  bool is_odd_step = current_step % 2 != 0;
-  float swing_factor = is_odd_step ? swing_amount : (1.0f - swing_amount);
-  float phase_inc = (1.0f / step_length_samples) * swing_factor;
-  // Advance phasor once per sample
-  phase += phase_inc;
+void SetupSynth() {
+  synth.Init(hw.AudioSampleRate(), delay_memory, KidSynth::DELAY_BUFFER_SIZE);
+  pattern_in_flight = false;
+  playing_pattern.length = 0;
+}
 
-  // Reset the step when the phase goes over 1.0, reset the env step, update the osc detune
-  if (phase >= 1.0f) {
-    ResetPhaseCycle();
+// Seed the pattern generator and the engine, and queue the first pattern
+void SetupPatterns(uint32_t seed) {
+  entropy.Init(seed);
+  pattern_generator.Init(entropy.Take());
+  ready_first = 0;
+  ready_count = 0;
+  while(ready_count < NUM_READY_PATTERNS) {
+    RefillPatterns();
   }
+  synth.Seed(entropy.Take());
+  SubmitPattern();
 }
 
-float bitcrush_quantize(float in, int bits) {
-  float max_level = (1 << bits) - 1;
-  float lsb = 1.0f / max_level;
-  float dither = ((rand() / (float)RAND_MAX) * 2.0f - 1.0f) * lsb * 0.5f;
-  float out = roundf((in + dither) * max_level) / max_level;
-  return out;
+// Write the bank to flash. Erasing takes most of the ~100ms this blocks the
+// main loop for; the audio plays on.
+bool SavePatternBank() {
+  const uint8_t* image = pattern_bank.Image();
+  const uint32_t end = PATTERN_BANK_OFFSET + PatternBank::ImageSize();
+  if(hw.qspi.Erase(PATTERN_BANK_OFFSET, end) != QSPIHandle::Result::OK) {
+    return false;
+  }
+  // libDaisy takes the buffer as non-const, but only reads it
+  return hw.qspi.Write(PATTERN_BANK_OFFSET, PatternBank::ImageSize(), const_cast<uint8_t*>(image)) ==
+         QSPIHandle::Result::OK;
 }
 
-float bitcrush_process(float in, int bits, int &counter, int step)
-{
-  static float hold = 0.0f;
-  if (counter <= 0)
-  {
-    hold = bitcrush_quantize(in, bits);
-    counter = step;
+// Load the pattern bank and queue the pattern saved last, so it plays
+// straight away. New patterns are seeded from the bank and whatever
+// entropy the main loop gathers before they are composed. Returns false if
+// flash holds no bank or no saved pattern.
+bool SetupSavedPatterns(uint32_t seed) {
+  pattern_bank.Load(hw.qspi.GetData(PATTERN_BANK_OFFSET));
+  Pattern pattern;
+  if(!pattern_bank.Recall(pattern_bank.BootSlot(), pattern)) {
+    return false;
   }
-  counter--;
-
-  // Gentle low-pass to reduce aliasing
-  const float lp_coeff = 0.2f;
-  bitcrush_lp += lp_coeff * (hold - bitcrush_lp);
-  return bitcrush_lp;
+  entropy.Init(seed ^ pattern_bank.Seed());
+  pattern_generator.Init(entropy.Take());
+  // The main loop composes them, one per millisecond
+  ready_first = 0;
+  ready_count = 0;
+  synth.Seed(entropy.Take());
+  QueuePattern(pattern);
+  recall_index = pattern_bank.SongLength() - 1;
+  return true;
 }
 
-// INIT FUNCTIONS //
-
-void InitSynthElements(int sample_rate) {
-  // Init oscillator
-  osc.Init(sample_rate);
-  osc.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-  osc.SetAmp(0.05f);
-
-  osc2.Init(sample_rate);
-  osc2.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-  osc2.SetAmp(0.08f);
-
-  osc3.Init(sample_rate);
-  osc3.SetWaveform(daisysp::Oscillator::WAVE_SQUARE);
-  osc3.SetAmp(0.06f);  // Sub-bass level
+// Store the pattern playing in the next free slot, add it to the song and
+// make it the one recalled at power-up. Does nothing before the first one
+// has started.
+void SaveCurrentPattern() {
+  const int slot = pattern_bank.NextSlot();
+  if(!pattern_bank.Store(slot, playing_pattern)) {
+    return;
+  }
+  pattern_bank.SetBootSlot(slot);
+  if(pattern_bank.AppendToSong(slot)) {
+    recall_index = pattern_bank.SongLength() - 1;
+  }
+  pattern_bank.SetSeed(entropy.Take());
+  SavePatternBank();
+}
 
-  // Init lfo
-  lfo.Init(sample_rate);
-  lfo.SetWaveform(daisysp::Oscillator::WAVE_SIN);
-  lfo.SetFreq(lfo_freq);
-  lfo.SetAmp(1.0f);
+// Queue the song's pattern at position index, wrapping round. Returns false
+// if the song is empty or the engine's queue is full.
+bool QueueSongPattern(int index) {
+  const int length = pattern_bank.SongLength();
+  if(length == 0) {
+    return false;
+  }
+  Pattern pattern;
+  return pattern_bank.Recall(pattern_bank.SongSlot(index % length), pattern) && QueuePattern(pattern);
+}
 
-  // Init filter
-  filter.Init(sample_rate);
+void RecallNextPattern() {
+  song_mode = false;
+  if(QueueSongPattern(recall_index + 1)) {
+    recall_index = (recall_index + 1) % pattern_bank.SongLength();
+  }
+}
 
-  // Remove DC offset from the output chain
-  dcblock.Init(sample_rate);
+// Double the length of new patterns, 8 to 64 steps and back round to 8.
+// The ready ones are composed again at the new length, as the same kind,
+// so the next tap already gets one and the alternation carries on.
+void CyclePatternLength() {
+  pattern_length = pattern_length * 2 > Pattern::MAX_STEPS ? Pattern::DEFAULT_STEPS : pattern_length * 2;
+  pattern_generator.Rewind(ready_count);
+  for(int i = 0; i < ready_count; i++) {
+    pattern_generator.Seed(entropy.Take());
+    pattern_generator.Generate(ready_patterns[(ready_first + i) % NUM_READY_PATTERNS], pattern_length);
+  }
+}
 
-  // Init delay
-  delay.Init();
-  delay.SetDelay(delay_smooth);
+void ToggleSong() {
+  song_mode = !song_mode && pattern_bank.SongLength() > 0;
+  song_index = 0;
+}
 
+// Empty the song, keeping the saved patterns, so saves start a new one
+void ClearSong() {
+  song_mode = false;
+  pattern_bank.ClearSong();
+  recall_index = -1;
+  SavePatternBank();
 }
 
-void UpdateWaveform() {
-  waveform_button.Debounce();
-  if(waveform_button.RisingEdge()) {
-    waveform_led_timer = LED_PULSE_MS;
-    if (waveform == daisysp::Oscillator::WAVE_SAW && !waveform_mixed_mode) {
-      // Mode 2: Pure square wave
-      waveform = daisysp::Oscillator::WAVE_SQUARE;
-      waveform_mixed_mode = false;
-      osc.SetAmp(0.035f);
-      osc2.SetAmp(0.056f);
-      osc.SetWaveform(daisysp::Oscillator::WAVE_SQUARE);
-      osc2.SetWaveform(daisysp::Oscillator::WAVE_SQUARE);
-    } else if (waveform == daisysp::Oscillator::WAVE_SQUARE && !waveform_mixed_mode) {
-      // Mode 3: Saw with sub-bass for fat low end
-      waveform = daisysp::Oscillator::WAVE_SAW;
-      waveform_mixed_mode = true;
-      osc.SetAmp(0.04f);
-      osc2.SetAmp(0.06f);
-      osc.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-      osc2.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-    } else {
-      // Mode 1: Pure saw wave
-      waveform = daisysp::Oscillator::WAVE_SAW;
-      waveform_mixed_mode = false;
-      osc.SetAmp(0.05f);
-      osc2.SetAmp(0.08f);
-      osc.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-      osc2.SetWaveform(daisysp::Oscillator::WAVE_SAW);
-    }
+// Audio rate and block size to run at. Hold a button while powering up to
+// pick another: delay for low latency, bitcrush for low CPU, waveform for
+// 96kHz. Needs the buttons set up.
+const AudioConfig& SelectAudioConfig() {
+  // Long enough for the debounce to register a held button
+  for(int ms = 0; ms < 10; ms++) {
+    delay_button.Debounce();
+    bitcrush_button.Debounce();
+    waveform_button.Debounce();
+    System::Delay(1);
+  }
+  AudioConfigId id = AUDIO_CONFIG_STANDARD;
+  if(delay_button.Pressed()) {
+    id = AUDIO_CONFIG_LOW_LATENCY;
+  } else if(bitcrush_button.Pressed()) {
+    id = AUDIO_CONFIG_LOW_CPU;
+  } else if(waveform_button.Pressed()) {
+    id = AUDIO_CONFIG_HIGH_RATE;
   }
+  return kAudioConfigs[id];
+}
 
-  if(waveform_led_timer > 0) {
-    waveform_led.Write(true);
-    waveform_led_timer--;
-  } else {
-    waveform_led.Write(false);
+void SetupAudio(const AudioConfig& config) {
+  SaiHandle::Config::SampleRate rate = SaiHandle::Config::SampleRate::SAI_48KHZ;
+  if(config.sample_rate == 32000.0f) {
+    rate = SaiHandle::Config::SampleRate::SAI_32KHZ;
+  } else if(config.sample_rate == 96000.0f) {
+    rate = SaiHandle::Config::SampleRate::SAI_96KHZ;
   }
+  hw.SetAudioSampleRate(rate);
+  hw.SetAudioBlockSize(config.block_size);
 }
 
 void SetupButtons() {
   // Delay Button
-  delay_button.Init(D1, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  delay_button.Init(D1, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
   delay_led.Init(D2, GPIO::Mode::OUTPUT);
 
   // Double tempo button
-  double_tempo_button.Init(D3, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  double_tempo_button.Init(D3, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
   double_tempo_led.Init(D4, GPIO::Mode::OUTPUT); 
 
    // Bitcrush button
-  bitcrush_button.Init(D5, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  bitcrush_button.Init(D5, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
   bitcrush_led.Init (D6, GPIO::Mode::OUTPUT);
 
   // Waveform button
-  waveform_button.Init(D7, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  waveform_button.Init(D7, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
   waveform_led.Init(D8, GPIO::Mode::OUTPUT);
 
 
   // New sequence button
-  sequence_button.Init(D9, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  sequence_button.Init(D9, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
   sequence_led.Init (D10, GPIO::Mode::OUTPUT);
 
    // New sequence button
-  swing_button.Init(D11, hw.AudioSampleRate(), Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
+  swing_button.Init(D11, CONTROL_RATE, Switch::TYPE_MOMENTARY, Switch::POLARITY_INVERTED, Switch::PULL_UP);
 }
 
 void SetupKnobs() {
-
-  // AnalogControl
-  tempo_knob.Init(
-    hw.adc.GetPtr(tempo),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  cutoff_knob.Init(
-    hw.adc.GetPtr(filter_cutoff),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  osc_mod_knob.Init(
-    hw.adc.GetPtr(osc_mod),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  sustain_knob.Init(
-    hw.adc.GetPtr(sustain),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  attack_mod_knob.Init(
-    hw.adc.GetPtr(attack_mod),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  cutoff_mod_slider.Init(
-    hw.adc.GetPtr(cutoff_slider),
-    hw.AudioSampleRate(),
-    true
-  );
-
-  // Map knob to frequency range
-  tempo_param.Init(tempo_knob, 80.0f, 320.0f, Parameter::LINEAR);
-
-  // Cutoff and resonance are a single knob macro
-  cutoff_param.Init(cutoff_knob, min_cutoff, max_cutoff, Parameter::LOGARITHMIC);
-  resonance_param.Init(cutoff_knob, 0.05f, 0.95f, Parameter::LINEAR);  // Wider resonance range
-
-  // Sustain time, not volume
-  sustain_param.Init(sustain_knob, 0.05f, 1.0, Parameter::LINEAR);
-
-  // Osc detune (joystick)
-  osc_mod_param.Init(osc_mod_knob, -1.0f, 1.0f, Parameter::LINEAR);
-  attack_mod_param.Init(attack_mod_knob, -1.0f, 1.0f, Parameter::LINEAR);
-
-  // Cutoff Mod slider (softpot)
-  cutoff_mod_slider_param.Init(cutoff_mod_slider, 0.0f, 1.0f, Parameter::LINEAR);
-
+  last_control_ms = System::GetNow();
+  knobs.Init(CONTROL_RATE);
+  // Knobs settle over ~10ms; the soft pot is played, so it follows faster.
+  // All read 1 at the bottom of their travel.
+  for(int ch = 0; ch < NUM_ADC_CHANNELS; ch++) {
+    if(ch == cutoff_slider) {
+      knobs.SetChannel(ch, &adc_snapshot[ch], 0.002f, 0.001f, true);
+    } else {
+      knobs.SetChannel(ch, &adc_snapshot[ch], 0.01f, 0.002f, true);
+    }
+  }
 }
 
 // CONTROL FUNCTIONS //
 
-void GenerateSequence() {
-  is_major = rand() % 2 == 0;
-  is_bassline = !is_bassline;
-  int starting_note = is_bassline? 24 : 36;  // Shifted down one octave
-  key_root = starting_note + (rand() % 7);
-
-  const int* scale = is_major ? MAJOR_SCALE : MINOR_SCALE;
-  int prev_degree = 0;
-  
-  // Choose melodic contour: 0=climb, 1=fall, 2=arch, 3=random walk
-  int contour = rand() % 4;
-  
-  for (int i = 0; i < NUM_STEPS; i++) {
-    int degree = 0;
-    
-    // First note is always root
-    if (i == 0) {
-      degree = 0;
-    } 
-    // Last note resolves
-    else if (i == NUM_STEPS - 1) {
-      degree = (rand() % 2 == 0) ? 0 : 4;  // Root or dominant
-    }
-    // Middle notes follow contour
-    else {
-      switch(contour) {
-        case 0: // Climb up
-          degree = (i * 7) / NUM_STEPS;
-          break;
-        case 1: // Fall down
-          degree = 6 - ((i * 6) / NUM_STEPS);
-          break;
-        case 2: // Arch (up then down)
-          degree = (i < NUM_STEPS/2) ? (i * 2) : (6 - (i - NUM_STEPS/2) * 2);
-          break;
-        case 3: // Random walk
-          int step_change = (rand() % 3) - 1;
-          degree = prev_degree + step_change;
-          break;
-      }
-      
-      // Allow repeated notes sometimes
-      if (rand() % 4 == 0) {
-        degree = prev_degree;
-      }
-      
-      // Clamp to scale
-      if (degree < 0) degree = 0;
-      if (degree > 6) degree = 6;
-    }
-    prev_degree = degree;
+void UpdateWaveform() {
+  waveform_button.Debounce();
+  if(waveform_button.RisingEdge() && sequence_button.Pressed()) {
+    // Shifted: recall the next saved pattern instead
+    sequence_hold_used = true;
+    RecallNextPattern();
+  } else if(waveform_button.RisingEdge()) {
+    waveform_led_timer = LED_PULSE_MS;
+    // Cycle saw -> square -> saw with sub-bass -> saw
+    waveform_mode = static_cast<KidSynth::WaveformMode>((waveform_mode + 1) % KidSynth::NUM_WAVEFORM_MODES);
+    synth.SetWaveformMode(waveform_mode);
+  }
 
-    // Octave jumps on strong beats (steps 0, 4)
-    int octave = 0;
-    if (!is_bassline && (i == 0 || i == 4) && rand() % 3 == 0) {
-      octave = 12;
-    }
-    
-    int note = key_root + scale[degree] + octave;
-    step_freqs[i] = 440.0f * powf(2.0f, (note - 69) / 12.0f);
-    
-    // Add rests: 15% chance, but never on first or last step
-    if (i > 0 && i < NUM_STEPS - 1 && rand() % 100 < 15) {
-      step_is_rest[i] = true;
-    } else {
-      step_is_rest[i] = false;
-    }
-    
-    // Velocity: accent strong beats (0, 4), softer on off-beats
-    if (i % 4 == 0) {
-      step_velocity[i] = 0.9f + (rand() % 10) / 100.0f;  // 0.9-1.0
-    } else if (i % 2 == 0) {
-      step_velocity[i] = 0.75f + (rand() % 10) / 100.0f;  // 0.75-0.85
-    } else {
-      step_velocity[i] = 0.6f + (rand() % 10) / 100.0f;  // 0.6-0.7
-    }
+  if(waveform_led_timer > 0) {
+    waveform_led.Write(true);
+    waveform_led_timer -= control_elapsed_ms;
+  } else {
+    waveform_led.Write(false);
   }
 }
 
 void UpdateTempo() {
-  tempo_knob.Process();
-  float target_tempo = tempo_param.Process();
   double_tempo_button.Debounce();
-  
+  const bool shifted = double_tempo_button.RisingEdge() && sequence_button.Pressed();
+  if(shifted) {
+    // Shifted: lengthen the patterns composed from now on instead
+    sequence_hold_used = true;
+    sequence_led_timer = LED_PULSE_MS;
+    CyclePatternLength();
+  }
+
   // Toggle double tempo on button press
-  if(double_tempo_button.RisingEdge()) {
+  const bool toggled = double_tempo_button.RisingEdge() && !shifted;
+  if(toggled) {
     double_tempo_enabled = !double_tempo_enabled;
+    double_tempo_led.Write(double_tempo_enabled);
   }
 
+  if(!knobs.Moved(tempo) && !toggled) {
+    return;
+  }
   // If the modify button is pressed, double the tempo. Otherwise, use the target tempo
-  bpm_target = double_tempo_enabled ? target_tempo * 2.0f : target_tempo;
-  double_tempo_led.Write(double_tempo_enabled);
+  float target_tempo = MapLinear(knobs.Position(tempo), 80.0f, 320.0f);
+  synth.SetTempo(double_tempo_enabled ? target_tempo * 2.0f : target_tempo);
 }
 
+// Tap for a new pattern, hold for a second to save the one playing. Held
+// down, it turns waveform into recall (the next saved pattern), swing into
+// song play (every saved pattern in turn, a bar each), bitcrush into
+// clearing the song and double tempo into the length of new patterns (8,
+// 16, 32 or 64 steps).
 void UpdateSequence() {
   sequence_button.Debounce();
+  TrackPlayingPattern();
   if(sequence_button.RisingEdge()) {
+    sequence_hold_ms = 0;
+    sequence_hold_used = false;
+  }
+  if(sequence_button.Pressed() && !sequence_hold_used) {
+    sequence_hold_ms += control_elapsed_ms;
+    if(sequence_hold_ms >= SAVE_HOLD_MS) {
+      sequence_hold_used = true;
+      sequence_led_timer = SAVE_LED_MS;
+      SaveCurrentPattern();
+    }
+  }
+  if(sequence_button.FallingEdge() && !sequence_hold_used) {
     sequence_led_timer = LED_PULSE_MS;
-    // Reseed RNG so each generated pattern is more unique
-    srand(GenerateRandomSeed());
-    GenerateSequence();
+    song_mode = false;
+    // Starts at the next bar. Taps faster than patterns are composed
+    // (one per ms) or faster than bars go by are dropped.
+    SubmitPattern();
+  }
+
+  // Each song pattern is queued once the one before has started
+  if(song_mode && !synth.PatternPending() && QueueSongPattern(song_index)) {
+    song_index = (song_index + 1) % pattern_bank.SongLength();
   }
 
   if(sequence_led_timer > 0) {
     sequence_led.Write(true);
-    sequence_led_timer--;
+    sequence_led_timer -= control_elapsed_ms;
   } else {
     sequence_led.Write(false);
   }
 }
 
 void UpdateSustainTime() {
-  float sustain_fraction = sustain_param.Process();
-  sustain_samples = sustain_fraction * step_length_samples;
+  if(knobs.Moved(sustain)) {
+    // Sustain time, not volume
+    synth.SetSustain(MapLinear(knobs.Position(sustain), 0.05f, 1.0f));
+  }
 }
 
 void UpdateFilterMacro() {
-  cutoff_knob.Process();
-  cutoff_target = cutoff_param.Process();
-  resonance = resonance_param.Process();
+  if(knobs.Moved(filter_cutoff)) {
+    // Cutoff and resonance are a single knob macro
+    const float position = knobs.Position(filter_cutoff);
+    synth.SetCutoff(MapLog(position, min_cutoff, max_cutoff));
+    synth.SetResonance(MapLinear(position, 0.05f, 0.95f));  // Wider resonance range
+  }
 }
 
 void UpdatePitchBend() {
-  cutoff_mod_slider.Process();
-  float softpot = cutoff_mod_slider_param.Process();
+  if(!knobs.Moved(cutoff_slider)) {
+    return;
+  }
+  float softpot = knobs.Position(cutoff_slider);
 
   // Touch detected (> 0.01)
   if(softpot > 0.01f) {
@@ -606,37 +538,37 @@ void UpdatePitchBend() {
     // This gives logarithmic response: gentle near center, dramatic at edges
     float sign = (normalized >= 0.0f) ? 1.0f : -1.0f;
     float abs_norm = fabsf(normalized);
-    float curved = sign * (powf(2.0f, abs_norm * 3.0f) - 1.0f) / 7.0f;
+    float curved = sign * (FastExp2(abs_norm * 3.0f) - 1.0f) / 7.0f;
     
-    pitch_bend_amount = curved * 24.0f;  // Scale to +/- 24 semitones
+    synth.SetPitchBend(curved * 24.0f);  // Scale to +/- 24 semitones
   } else {
     // Finger lifted - no bend
-    pitch_bend_amount = 0.0f;
-  }
-
-  // Immediately apply pitch bend to the currently playing note
-  if (current_base_freq > 0.0f) {
-    float bend_ratio = powf(2.0f, pitch_bend_amount / 12.0f);
-    float bent_freq = current_base_freq * bend_ratio;
-    UpdateOscFrequencies(bent_freq);
+    synth.SetPitchBend(0.0f);
   }
 }
 
+// Osc detune (joystick)
 void UpdateDetuneMod() {
-  osc_mod_knob.Process();
-  osc_mod_amount = osc_mod_param.Process();
+  if(knobs.Moved(osc_mod)) {
+    synth.SetDetuneMod(MapLinear(knobs.Position(osc_mod), -1.0f, 1.0f));
+  }
 }
 
 void UpdateAttackMod() {
-  attack_mod_knob.Process();
-  attack_mod_amount = attack_mod_param.Process();
+  if(knobs.Moved(attack_mod)) {
+    synth.SetAttackMod(MapLinear(knobs.Position(attack_mod), -1.0f, 1.0f));
+  }
 }
 
 void UpdateSwing() {
   swing_button.Debounce();
-  if(swing_button.RisingEdge()) {
+  if(swing_button.RisingEdge() && sequence_button.Pressed()) {
+    // Shifted: start or stop the song instead
+    sequence_hold_used = true;
+    ToggleSong();
+  } else if(swing_button.RisingEdge()) {
     is_swing = !is_swing;
-    swing_amount = is_swing ? 0.6 : 0.5;
+    synth.SetSwing(is_swing);
   }
 }
 
@@ -646,20 +578,25 @@ void UpdateDelay() {
   // Toggle delay on button press
   if(delay_button.RisingEdge()) {
     delay_enabled = !delay_enabled;
+    synth.SetDelayEnabled(delay_enabled);
+    delay_led.Write(delay_enabled);
   }
-  
-  delay_led.Write(delay_enabled);
 }
 
 void UpdateBitcrush() {
   bitcrush_button.Debounce();
   
-  // Toggle bitcrush on button press
-  if(bitcrush_button.RisingEdge()) {
+  if(bitcrush_button.RisingEdge() && sequence_button.Pressed()) {
+    // Shifted: clear the song instead
+    sequence_hold_used = true;
+    sequence_led_timer = SAVE_LED_MS;
+    ClearSong();
+  } else if(bitcrush_button.RisingEdge()) {
+    // Toggle bitcrush on button press
     bitcrush_enabled = !bitcrush_enabled;
+    synth.SetBitcrushEnabled(bitcrush_enabled);
+    bitcrush_led.Write(bitcrush_enabled);
   }
-  
-  bitcrush_led.Write(bitcrush_enabled);
 }
 
 // SPECIAL FEATURE: hold Delay + Double Tempo for 3 seconds to toggle master volume to 50%
@@ -670,12 +607,13 @@ void UpdateVolumeToggle() {
   if (both_pressed) {
     // Count milliseconds while both buttons are held
     if (volume_hold_ms < 3000) {
-      volume_hold_ms++;
+      volume_hold_ms += control_elapsed_ms;
     }
 
     // After ~3 seconds, toggle volume once per hold
     if (volume_hold_ms >= 3000 && !volume_hold_triggered) {
       half_volume_enabled = !half_volume_enabled;
+      synth.SetHalfVolume(half_volume_enabled);
       volume_hold_triggered = true;
     }
   } else {
@@ -685,115 +623,174 @@ void UpdateVolumeToggle() {
   }
 }
 
-void MyCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size) {
-  for (size_t i = 0; i < size; i++) {
+void TraceButtons() {
+  for(int b = 0; b < NUM_BUTTONS; b++) {
+    if(button_switches[b]->RisingEdge()) {
+      control_trace.Write(control_time, TRACE_BUTTON, b, 1.0f);
+    } else if(button_switches[b]->FallingEdge()) {
+      control_trace.Write(control_time, TRACE_BUTTON, b, 0.0f);
+    }
+  }
+}
 
-    UpdateClock();
+void UpdateCpuStats() {
+  cpu_stats_ms += control_elapsed_ms;
+  if(cpu_stats_ms >= 1000) {
+    cpu_stats_ms = 0;
+    synth.ReadProfile(cpu_stats);
+  }
+}
 
-    // Calculate the envelope
-    UpdateEnvelope();
+// Sample time for the control changes made now. After a callback the audio
+// clock points at the start of the next block, so adding the time since the
+// callback started puts the change the same distance into the next block.
+// That is a fixed block of latency, and changes keep their exact spacing
+// rather than bunching up on block boundaries. clock is the audio clock it
+// was worked out from.
+uint32_t ControlTime(uint32_t& clock) {
+  uint32_t start_us;
+  do {
+    start_us = callback_us;
+    clock = synth.SampleClock();
+  } while(start_us != callback_us);
+
+  const uint32_t block = hw.AudioBlockSize();
+  uint32_t elapsed = static_cast<uint32_t>((System::GetUs() - start_us) * hw.AudioSampleRate() * 1.0e-6f);
+  if(elapsed > block) {
+    elapsed = block;
+  }
+  return clock + elapsed;
+}
 
-    // Update the signal, and warm it up & drive
-    float sig = osc.Process();
-    float sig2 = osc2.Process();
-    float sig3 = osc3.Process();
-    
-    // Apply consistent drive to all waveforms
-    float osc_drive = 2.0f;
-    sig = tanhf(sig * osc_drive);
-    sig2 = tanhf(sig2 * osc_drive);
-    sig3 = tanhf(sig3 * osc_drive);
-
-    // Update the lfo
-    float lfo_sig = lfo.Process();
-
-    // Add in detune osc with level compensation to prevent clipping
-    float detune_amount = fabs(osc_mod_amount);
-    sig = (sig * (1.0f - detune_amount * 0.3f)) + (sig2 * detune_amount * 0.7f);
-    
-    // Add sub-bass ONLY when in saw+sub mode (mode 3)
-    if (waveform_mixed_mode && waveform == daisysp::Oscillator::WAVE_SAW) {
-      sig = sig * 0.7f + sig3 * 0.5f;
-    }
+#if KIDSYNTH_RECORD
+// Starts the control recording over, from patterns set up with seed
+void StartGestureRecording(uint32_t seed) {
+  gestures.Start(gesture_memory, GESTURE_MEMORY_SIZE, seed, static_cast<uint32_t>(hw.AudioSampleRate()),
+                 hw.AudioBlockSize(), NUM_ADC_CHANNELS, NUM_BUTTONS);
+}
 
-    // Apply the filter
-    cutoff_smooth += 0.002f * (cutoff_target - cutoff_smooth);
-    // Compute and clamp filter frequency to a safe audible range
-    // Gate LFO modulation by envelope to prevent wandering during silence
-    float env_gate = fmaxf(env, 0.1f);  // Minimum 10% modulation depth
-    float cutoff_modulated = (cutoff_smooth + (500.0f * lfo_sig * env_gate)) + (env * 1000.0f);
-    cutoff_modulated = fminf(fmaxf(cutoff_modulated, 20.0f), 12000.0f);
-    filter.SetFreq(cutoff_modulated);
-    // Keep resonance within a stable range
-    float res_mod = resonance + (lfo_sig * 0.02f * env_gate);  // Increased from 0.01 and gated
-    res_mod = fminf(fmaxf(res_mod, 0.1f), 0.98f);
-    filter.SetRes(res_mod);
-    filter.Process(sig);
-    float out_sig = filter.Low();
-
-    // Add bitcrush to mix;
-    if(bitcrush_enabled) {
-      int bits = 8; // Slightly higher resolution for a gentler effect
-      int step = static_cast<int>(step_length_samples / 128.0f);
-      step = fminf(fmaxf(step, 2), 8); // Shorter hold time for less aggressive crush
-      out_sig = bitcrush_process(out_sig, bits, bitcrush_counter, step);
-    }
+// The recording so far, size bytes of it
+const uint8_t* GestureRecording(size_t& size) {
+  size = gestures.Size();
+  return gesture_memory;
+}
 
-    // Post-filter saturation for warmth and character
-    out_sig = tanhf(out_sig * 1.2f) * 0.9f;  // Gentle saturation
+// The switches debounce their own pin reads, a moment later; a press that
+// lands in between shows up a tick late on replay
+void RecordControls(uint32_t now_ms, uint32_t clock) {
+  ControlFrame frame;
+  frame.ms = now_ms;
+  frame.us = control_us;
+  frame.clock = clock;
+  frame.sample_time = control_time;
+  for(int ch = 0; ch < NUM_ADC_CHANNELS; ch++) {
+    frame.adc[ch] = adc_snapshot[ch];
+  }
+  frame.buttons = 0;
+  for(int b = 0; b < NUM_BUTTONS; b++) {
+    frame.buttons |= button_switches[b]->RawState() << b;
+  }
+  gestures.Record(frame);
+}
+#endif
+
+// UpdateControls() for a given audio clock and control time; the host
+// replays recordings through it
+void UpdateControlsAt(uint32_t clock, uint32_t time) {
+  const uint32_t now_ms = System::GetNow();
+  control_elapsed_ms = now_ms - last_control_ms;
+  last_control_ms = now_ms;
+  control_us = System::GetUs();
+  control_time = time;
+  for(int ch = 0; ch < NUM_ADC_CHANNELS; ch++) {
+    adc_snapshot[ch] = hw.adc.Get(ch);
+  }
+#if KIDSYNTH_RECORD
+  RecordControls(now_ms, clock);
+#else
+  (void)clock;
+#endif
+  synth.SetControlTime(control_time);
+  synth.RetryParams();
+  knobs.Scan();
+  GatherEntropy();
+  RefillPatterns();
+  UpdateTempo();
+  UpdateWaveform();
+  UpdateSequence();
+  UpdateSustainTime();
+  UpdateFilterMacro();
+  UpdatePitchBend();
+  UpdateDetuneMod();
+  UpdateAttackMod();
+  UpdateDelay();
+  UpdateBitcrush();
+  UpdateSwing();
+  UpdateVolumeToggle();
+#if KIDSYNTH_TRACE
+  TraceButtons();
+#endif
+  UpdateCpuStats();
+}
 
-    // Filter drive
-    float filter_drive = 0.65f;  // Increased output level
-    out_sig *= filter_drive;
+// Check all controls and update the state of the synth accordingly.
+// Runs once per millisecond from the main loop.
+void UpdateControls() {
+  uint32_t clock;
+  const uint32_t time = ControlTime(clock);
+  UpdateControlsAt(clock, time);
+}
 
-    // Envelope is applied to the dry signal
+KIDSYNTH_ITCM void MyCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size) {
+  callback_us = System::GetUs();
+  synth.Process(out[0], size);
+  for (size_t i = 0; i < size; i++) {
+    out[1][i] = out[0][i];
+  }
+}
 
-    // Amp modulation with per-step velocity
-    float velocity = step_is_rest[current_step] ? 0.0f : step_velocity[current_step];
-    float mod_amp = env * velocity * (1.0f + lfo_sig * 0.05f); // 5% amplitude swing for subtle movement
-    out_sig *= mod_amp;
-    
-    // Noise gate: cut signal when envelope is very low
-    if (env < 0.005f) {
-      out_sig *= env / 0.005f;  // Fade to zero below threshold
-    }
 
-    // Add delay after envelope so repeats can ring out independently
-    if(delay_enabled) {
-      delay_smooth += 0.0003f * (delay_target - delay_smooth);
-      float delayed = delay.Read(delay_smooth);
-      
-      // High-pass filter the delayed signal to reduce muddiness
-      static float hp_delayed = 0.0f;
-      float hp_coeff = 0.92f;  // Gentler high-pass to keep some warmth
-      hp_delayed = hp_coeff * (hp_delayed + delayed - delayed);
-      delayed = delayed - hp_delayed;
-      
-      // Write envelope-shaped signal to delay for natural decay
-      float delay_feedback = 0.30f;  // More repeats for richer delay
-      delay.Write(out_sig + (delayed * delay_feedback));
-      out_sig = out_sig * (1-mix) + (delayed * mix);
+// The host build (host/Makefile) provides its own entry point and drives
+// the engine and UpdateControls() directly.
+#ifndef KIDSYNTH_HOST
+#if KIDSYNTH_TRACE
+// Two batches: one is filled while USB may still be reading the other
+TraceBatch trace_batches[2];
+int trace_fill = 0;
+bool trace_batch_ready = false;  // trace_batches[trace_fill] waits to go
+
+// Sends the trace, a batch at a time. A batch waits until USB has taken the
+// one before, and the rings fill up meanwhile, so a slow or absent host
+// costs dropped records rather than time.
+//
+// TransmitInternal only queues the transfer, so the batch it took is left
+// alone until USB takes the next one too. CDC turns a transfer away while
+// the last is still going, so by then the older batch has been read and is
+// free to refill.
+void DrainTrace() {
+  TraceBatch& batch = trace_batches[trace_fill];
+  if(!trace_batch_ready) {
+    batch.magic = TraceBatch::MAGIC;
+    batch.count = 0;
+    batch.dropped = static_cast<uint16_t>(synth.TakeTraceDropped() + control_trace.TakeDropped());
+    while(batch.count < TraceBatch::MAX_RECORDS && synth.ReadTrace(batch.records[batch.count])) {
+      batch.count++;
     }
-    
-    out_sig = dcblock.Process(out_sig);
-    
-    // Gentle one-pole low-pass to roll off high-frequency hiss (8kHz-ish)
-    static float hp_smooth = 0.0f;
-    float lp_coeff = 0.7f;  // Adjusts cutoff frequency
-    hp_smooth = hp_smooth * lp_coeff + out_sig * (1.0f - lp_coeff);
-    out_sig = hp_smooth;
-
-    // Apply master volume toggle (50% when enabled)
-    float master_gain = half_volume_enabled ? 0.5f : 1.0f;
-    out_sig *= master_gain;
-    
-    //out_sig *= 1.5f; // Master volume boost
-
-    out[0][i] = out_sig;
-    out[1][i] = out_sig;
+    while(batch.count < TraceBatch::MAX_RECORDS && ReadControlTrace(batch.records[batch.count])) {
+      batch.count++;
+    }
+    if(batch.count == 0 && batch.dropped == 0) {
+      return;
+    }
+    trace_batch_ready = true;
+  }
+  // Busy while the last transfer is still going; try again next time
+  if(hw.usb_handle.TransmitInternal(reinterpret_cast<uint8_t*>(&batch), batch.Bytes()) == UsbHandle::Result::OK) {
+    trace_batch_ready = false;
+    trace_fill ^= 1;
   }
 }
-
+#endif
 
 int main(void) {
 
@@ -801,10 +798,17 @@ int main(void) {
   hw.Configure();
   hw.Init();
   // hw.StartLog();  // Disabled - causes USB instability during audio
+#if KIDSYNTH_TRACE
+  // Raw USB serial for the trace rather than the logger, see DrainTrace()
+  hw.usb_handle.Init(UsbHandle::FS_INTERNAL);
+#endif
+
+  // The buttons are read at power-up to pick the audio config
+  SetupButtons();
+  SetupAudio(SelectAudioConfig());
 
   // Setup oscillators, filters, and delay
-  int sample_rate = hw.AudioSampleRate();
-  InitSynthElements(sample_rate);
+  SetupSynth();
 
   // Create an ADC Channel Config object
   AdcChannelConfig adc_config[NUM_ADC_CHANNELS];
@@ -819,14 +823,18 @@ int main(void) {
   hw.adc.Start();
 
   // Configure the UI controls
-  SetupButtons();
   SetupKnobs();
 
-  // Random seed so we get different patterns
-  srand(GenerateRandomSeed());
-
-  // Setup the inital sequence
-  GenerateSequence();
+  // Carry on from the pattern saved last. Without one, take a random seed,
+  // which waits 16ms for ADC noise, and compose the first pattern.
+  uint32_t seed = System::GetUs();
+  if(!SetupSavedPatterns(seed)) {
+    seed = GenerateRandomSeed();
+    SetupPatterns(seed);
+  }
+#if KIDSYNTH_RECORD
+  StartGestureRecording(seed);
+#endif
 
   // Start the audio
   hw.StartAudio(MyCallback);
@@ -835,20 +843,11 @@ int main(void) {
   // uint32_t piezo_cooldown = 0;
 
   while (1) {
-    // Check all controls and update the state of the synth accordingly
-    UpdateTempo();
-    UpdateWaveform();
-    UpdateSequence();
-    UpdateSustainTime();
-    UpdateFilterMacro();
-    UpdatePitchBend();
-    UpdateDetuneMod();
-    UpdateAttackMod();
-    UpdateDelay();
-    UpdateBitcrush();
-    UpdateSwing();
-    UpdateVolumeToggle();
-
+    UpdateControls();
+#if KIDSYNTH_TRACE
+    DrainTrace();
+#endif
     System::Delay(1);
   }
 }
+#endif
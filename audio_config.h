@@ -0,0 +1,45 @@
+// Audio sample rate and block size, chosen once at startup.
+//
+// The engine takes every time-dependent setting as seconds or Hz and turns
+// it into per-sample coefficients in Init(), with the helpers below, so all
+// configs sound the same. Only the latency and CPU load change: small
+// blocks respond sooner, and a lower rate or bigger blocks cost less.
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+struct AudioConfig {
+  const char* name;
+  float sample_rate;  // 32000, 48000 or 96000
+  size_t block_size;
+};
+
+enum AudioConfigId {
+  AUDIO_CONFIG_STANDARD,     // 48kHz, 1ms blocks
+  AUDIO_CONFIG_LOW_LATENCY,  // 48kHz, 0.17ms blocks
+  AUDIO_CONFIG_LOW_CPU,      // 32kHz, 4ms blocks
+  AUDIO_CONFIG_HIGH_RATE,    // 96kHz, 1ms blocks
+  NUM_AUDIO_CONFIGS
+};
+
+constexpr AudioConfig kAudioConfigs[NUM_AUDIO_CONFIGS] = {
+  {"standard", 48000.0f, 48},
+  {"low_latency", 48000.0f, 8},
+  {"low_cpu", 32000.0f, 128},
+  {"high_rate", 96000.0f, 96},
+};
+
+constexpr float kMaxSampleRate = 96000.0f;
+
+constexpr bool IsSupportedSampleRate(float sample_rate) {
+  return sample_rate == 32000.0f || sample_rate == 48000.0f || sample_rate == 96000.0f;
+}
+
+// Per-sample coefficient of a one-pole smoother, y += c * (x - y), that
+// covers 63% of a step in seconds
+inline float OnePoleCoeff(float seconds, float sample_rate) { return 1.0f - expf(-1.0f / (seconds * sample_rate)); }
+
+// The same for a one-pole low-pass with its -3dB point at cutoff_hz
+inline float OnePoleLowpassCoeff(float cutoff_hz, float sample_rate) {
+  return 1.0f - expf(-2.0f * static_cast<float>(M_PI) * cutoff_hz / sample_rate);
+}
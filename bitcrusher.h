@@ -0,0 +1,88 @@
+// Bit reduction and sample-rate reduction.
+//
+// Each input sample is quantized to the set number of bits and held for a
+// number of samples, which may be fractional: the leftover fraction carries
+// over, so a hold of 2.5 alternates between 2 and 3 and the average rate is
+// exact. A one-pole low-pass after the hold takes the edge off the steps.
+//
+// The quantizer is dithered with TPDF noise (the sum of two uniform values,
+// +/-1 LSB), which leaves the error uncorrelated with the signal and free of
+// noise modulation. The noise comes from the crusher's own xorshift
+// generator, so it costs a few integer operations per held sample and
+// doesn't disturb any other random sequence.
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+class Bitcrusher {
+ public:
+  // Clears the hold and the filter
+  void Init() {
+    counter_ = 0.0f;
+    hold_ = 0.0f;
+    lp_ = 0.0f;
+  }
+
+  // Restarts the dither noise
+  void Seed(uint32_t seed) {
+    // xorshift has a fixed point at zero
+    rng_state_ = seed ? seed : 0x9e3779b9u;
+  }
+
+  // Resolution, 1 to 16 bits
+  void SetBits(int bits) {
+    bits = bits < 1 ? 1 : (bits > 16 ? 16 : bits);
+    levels_ = static_cast<float>((1 << bits) - 1);
+    inv_levels_ = 1.0f / levels_;
+  }
+
+  // Samples each quantized value is held for, 1 or more. Set once per block.
+  void SetHold(float samples) { hold_samples_ = samples < 1.0f ? 1.0f : samples; }
+
+  // Per-sample coefficient of the low-pass after the hold; 1 turns it off
+  void SetLowpass(float coeff) { lp_coeff_ = coeff; }
+
+  void Process(float* buf, size_t size) {
+    const float hold_samples = hold_samples_;
+    const float lp_coeff = lp_coeff_;
+    float counter = counter_;
+    float hold = hold_;
+    float lp = lp_;
+    for (size_t i = 0; i < size; i++) {
+      if (counter <= 0.0f) {
+        hold = Quantize(buf[i]);
+        counter += hold_samples;
+      }
+      counter -= 1.0f;
+      lp += lp_coeff * (hold - lp);
+      buf[i] = lp;
+    }
+    counter_ = counter;
+    hold_ = hold;
+    // Rings down into denormals once the input is silent
+    lp_ = fabsf(lp) < 1.0e-20f ? 0.0f : lp;
+  }
+
+ private:
+  float Quantize(float in) {
+    // xorshift32; its two halves make the two uniform values
+    uint32_t x = rng_state_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state_ = x;
+    const float tpdf = static_cast<float>(static_cast<int32_t>(x & 0xffffu) + static_cast<int32_t>(x >> 16) - 65535) *
+                       (1.0f / 65536.0f);
+    return floorf(in * levels_ + tpdf + 0.5f) * inv_levels_;
+  }
+
+  uint32_t rng_state_ = 1;
+  float levels_ = 255.0f;  // Quantization steps per unit
+  float inv_levels_ = 1.0f / 255.0f;
+  float hold_samples_ = 1.0f;
+  float lp_coeff_ = 1.0f;
+  float counter_ = 0.0f;  // Samples until the next value is taken
+  float hold_ = 0.0f;
+  float lp_ = 0.0f;
+};
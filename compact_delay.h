@@ -0,0 +1,67 @@
+// Delay line stored as 16-bit samples.
+//
+// Half the memory of a float line of the same length, with 96dB of dynamic
+// range, which is plenty for repeats that sit well under the dry signal.
+// The caller provides the storage, so on the Seed it can live in SDRAM
+// rather than eat into internal RAM. Reads take a fractional delay and
+// interpolate linearly, so the delay time can glide without zipper noise.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class CompactDelay {
+ public:
+  // Clears and takes over size samples of buffer, which must outlive the
+  // delay. SDRAM isn't zeroed at boot, so this does it.
+  void Init(int16_t* buffer, size_t size) {
+    buffer_ = buffer;
+    size_ = size;
+    write_pos_ = 0;
+    for (size_t i = 0; i < size; i++) {
+      buffer_[i] = 0;
+    }
+  }
+
+  size_t Size() const { return size_; }
+
+  // delay in samples, 1 to Size() - 2
+  float Read(float delay) const {
+    const size_t whole = static_cast<size_t>(delay);
+    const float frac = delay - whole;
+    size_t pos = write_pos_ + whole;
+    pos = pos >= size_ ? pos - size_ : pos;
+    size_t next = pos + 1;
+    next = next >= size_ ? next - size_ : next;
+    const float a = buffer_[pos];
+    const float b = buffer_[next];
+    return (a + (b - a) * frac) * kFromInt;
+  }
+
+  // Zeroes count samples, from a delay of delay on into the past, so that a
+  // long line can be cleared a piece at a time
+  void Clear(size_t delay, size_t count) {
+    size_t pos = write_pos_ + delay;
+    pos = pos >= size_ ? pos - size_ : pos;
+    for (size_t i = 0; i < count; i++) {
+      buffer_[pos] = 0;
+      pos = pos + 1 == size_ ? 0 : pos + 1;
+    }
+  }
+
+  // Writes the next sample, clipped to +/-1
+  void Write(float in) {
+    in = in > 1.0f ? 1.0f : (in < -1.0f ? -1.0f : in);
+    // Round to nearest rather than toward zero, which would add distortion
+    buffer_[write_pos_] = static_cast<int16_t>(in * kToInt + (in < 0.0f ? -0.5f : 0.5f));
+    write_pos_ = write_pos_ == 0 ? size_ - 1 : write_pos_ - 1;
+  }
+
+ private:
+  static constexpr float kToInt = 32767.0f;
+  static constexpr float kFromInt = 1.0f / 32767.0f;
+
+  // Moves backwards through the buffer, so a delay of d is at write_pos_ + d
+  int16_t* buffer_ = nullptr;
+  size_t size_ = 0;
+  size_t write_pos_ = 0;
+};
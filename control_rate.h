@@ -0,0 +1,105 @@
+// Control-rate modulation sources.
+//
+// Slow modulation doesn't need computing every sample. These update once
+// every CONTROL_INTERVAL samples, and what they drive is interpolated
+// linearly between those points, so it moves without steps. The interval
+// carries across block boundaries, so the result doesn't depend on the
+// block size.
+//
+// ControlSmoother is a one-pole glide towards a target. Once it is within
+// its snap distance it jumps to the target and goes idle, and from then on
+// filling a buffer is just a copy of a constant until the target moves.
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+constexpr size_t CONTROL_INTERVAL = 16;
+
+class ControlSmoother {
+ public:
+  // coeff is the one-pole coefficient per sample, as for an audio-rate
+  // smoother; snap is the distance from the target at which it stops
+  void Init(float coeff, float snap, float value) {
+    coeff_ = 1.0f - powf(1.0f - coeff, static_cast<float>(CONTROL_INTERVAL));
+    snap_ = snap;
+    Reset(value);
+  }
+
+  // Jumps straight to value and idles there
+  void Reset(float value) {
+    target_ = value;
+    point_ = value;
+    out_ = value;
+    inc_ = 0.0f;
+    left_ = 0;
+  }
+
+  void SetTarget(float target) { target_ = target; }
+
+  // At the target with nothing left to interpolate
+  bool Idle() const { return left_ == 0 && point_ == target_; }
+  float Value() const { return out_; }
+
+  void Process(float* out, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+      if (left_ == 0) {
+        if (point_ == target_) {
+          for (; i < size; i++) {
+            out[i] = out_;
+          }
+          return;
+        }
+        NextPoint();
+      }
+      const size_t n = left_ < size - i ? left_ : size - i;
+      for (size_t k = 0; k < n; k++) {
+        out_ += inc_;
+        out[i + k] = out_;
+      }
+      i += n;
+      left_ -= n;
+      if (left_ == 0) {
+        out_ = point_;  // No rounding error carried into the next segment
+      }
+    }
+  }
+
+ private:
+  void NextPoint() {
+    float next = point_ + coeff_ * (target_ - point_);
+    next = fabsf(target_ - next) < snap_ ? target_ : next;
+    inc_ = (next - point_) * (1.0f / CONTROL_INTERVAL);
+    point_ = next;
+    left_ = CONTROL_INTERVAL;
+  }
+
+  float coeff_ = 1.0f;
+  float snap_ = 0.0f;
+  float target_ = 0.0f;
+  float point_ = 0.0f;  // Value at the end of the current segment
+  float out_ = 0.0f;    // Last value written
+  float inc_ = 0.0f;
+  size_t left_ = 0;     // Samples to go in the current segment
+};
+
+// Sine LFO, -1 to 1, starting at 0 and rising. Read once per control
+// interval by the modulation matrix, which interpolates what it drives.
+class ControlLfo {
+ public:
+  void Init(float sample_rate, float freq) {
+    phase_inc_ = freq * CONTROL_INTERVAL / sample_rate;
+    phase_ = 0.0f;
+  }
+
+  // Value at the next control point
+  float Next() {
+    phase_ += phase_inc_;
+    phase_ -= phase_ >= 1.0f ? 1.0f : 0.0f;
+    return sinf(2.0f * static_cast<float>(M_PI) * phase_);
+  }
+
+ private:
+  float phase_inc_ = 0.0f;  // Cycles per control point
+  float phase_ = 0.0f;
+};
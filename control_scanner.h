@@ -0,0 +1,93 @@
+// Change-driven scanning of the analog controls.
+//
+// The main loop scans every millisecond, but knobs mostly sit still. Each
+// channel is read straight from the ADC's DMA buffer and low-passed at the
+// rate it is actually scanned at; a change is only reported once the
+// filtered position has moved further than the channel's dead band from the
+// last position reported. ADC noise then never gets through, and the
+// mappings and control changes downstream only run when a knob is turned.
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+template <int NUM_CHANNELS>
+class KnobScanner {
+ public:
+  static_assert(NUM_CHANNELS <= 32, "one bit per channel");
+
+  // update_rate is how often Scan() is called, in Hz
+  void Init(float update_rate) {
+    update_rate_ = update_rate;
+    moved_ = 0;
+    primed_ = false;
+  }
+
+  // raw points at the channel's 16-bit reading. slew_seconds is the
+  // low-pass time constant and dead_band the smallest move reported, as a
+  // fraction of the travel. flip reverses the travel (1 at the bottom).
+  void SetChannel(int channel, const uint16_t* raw, float slew_seconds, float dead_band, bool flip) {
+    Channel& ch = channels_[channel];
+    ch.raw = raw;
+    ch.coeff = 1.0f - expf(-1.0f / (slew_seconds * update_rate_));
+    ch.dead_band = dead_band;
+    ch.flip = flip;
+    ch.filtered = 0.0f;
+    ch.position = 0.0f;
+  }
+
+  // Reads and filters every channel. Returns a bit per channel whose
+  // position changed; the first scan reports every channel, at its reading.
+  uint32_t Scan() {
+    uint32_t moved = 0;
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      Channel& ch = channels_[c];
+      float in = *ch.raw * (1.0f / 65535.0f);
+      in = ch.flip ? 1.0f - in : in;
+      if (!primed_) {
+        ch.filtered = in;
+        ch.position = in;
+        moved |= 1u << c;
+        continue;
+      }
+      ch.filtered += ch.coeff * (in - ch.filtered);
+
+      // Snap to the ends so a knob turned all the way reaches them, however
+      // small the last move
+      float target = ch.filtered;
+      target = target < ch.dead_band ? 0.0f : (target > 1.0f - ch.dead_band ? 1.0f : target);
+      if (fabsf(target - ch.position) > ch.dead_band || ((target == 0.0f || target == 1.0f) && target != ch.position)) {
+        ch.position = target;
+        moved |= 1u << c;
+      }
+    }
+    primed_ = true;
+    moved_ = moved;
+    return moved;
+  }
+
+  // Whether the last Scan() reported the channel
+  bool Moved(int channel) const { return (moved_ >> channel) & 1u; }
+  // Last reported position, 0 to 1
+  float Position(int channel) const { return channels_[channel].position; }
+
+ private:
+  struct Channel {
+    const uint16_t* raw = nullptr;
+    float coeff = 1.0f;
+    float dead_band = 0.0f;
+    bool flip = false;
+    float filtered = 0.0f;
+    float position = 0.0f;
+  };
+
+  Channel channels_[NUM_CHANNELS];
+  float update_rate_ = 1000.0f;
+  uint32_t moved_ = 0;
+  bool primed_ = false;
+};
+
+// Knob position (0 to 1) to a parameter range
+inline float MapLinear(float position, float min, float max) { return min + position * (max - min); }
+
+// Equal steps of travel give equal ratios, for frequencies; min must be > 0
+inline float MapLog(float position, float min, float max) { return min * expf(position * logf(max / min)); }
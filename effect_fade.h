@@ -0,0 +1,62 @@
+// Click-free switching of effects in and out.
+//
+// Turning an effect on or off doesn't switch it on the spot: its gain, the
+// mix between the signal without it (0) and with it (1), fades linearly
+// over a few milliseconds. The fade moves on once per block, and the block
+// passes ramp the gain across the block themselves.
+//
+// Advance() also says which of three states the effect is in for the
+// block. The engine picks a version of the effect chain built for exactly
+// that combination of states, so an effect that is fully in or fully out
+// costs no more than if it were hard-wired that way, and only the blocks of
+// a fade pay for running both paths.
+#pragma once
+#include <cstddef>
+
+enum EffectState {
+  EFFECT_OFF,     // Bypassed; the effect doesn't run
+  EFFECT_ON,      // Fully in
+  EFFECT_FADING,  // Mixed in by a gain going from Start() to End()
+  NUM_EFFECT_STATES
+};
+
+class EffectFade {
+ public:
+  // fade_samples is the length of a whole fade. Skips to the end of any
+  // fade in progress.
+  void Init(float fade_samples) {
+    step_ = 1.0f / fade_samples;
+    gain_ = target_;
+    start_ = target_;
+  }
+
+  // May be called before Init(), which then starts the effect on or off
+  void SetEnabled(bool enabled) { target_ = enabled ? 1.0f : 0.0f; }
+  bool Enabled() const { return target_ != 0.0f; }
+
+  // Moves the fade on over the next block of samples and returns the
+  // effect's state for it
+  EffectState Advance(size_t samples) {
+    start_ = gain_;
+    if (gain_ == target_) {
+      return gain_ != 0.0f ? EFFECT_ON : EFFECT_OFF;
+    }
+    const float step = samples * step_;
+    if (target_ > gain_) {
+      gain_ = gain_ + step < target_ ? gain_ + step : target_;
+    } else {
+      gain_ = gain_ - step > target_ ? gain_ - step : target_;
+    }
+    return EFFECT_FADING;
+  }
+
+  // Gain at the start and the end of the block last advanced over
+  float Start() const { return start_; }
+  float End() const { return gain_; }
+
+ private:
+  float step_ = 1.0f;
+  float target_ = 0.0f;
+  float gain_ = 0.0f;
+  float start_ = 0.0f;
+};
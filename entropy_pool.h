@@ -0,0 +1,51 @@
+// Randomness gathered a little at a time.
+//
+// The main loop stirs in whatever is noisy (ADC LSBs, timer jitter) every
+// millisecond, so a seed is ready whenever one is needed instead of being
+// collected on demand.
+#pragma once
+#include <cstdint>
+
+class EntropyPool {
+ public:
+  void Init(uint32_t seed) {
+    for (int i = 0; i < kSize; i++) {
+      pool_[i] = 0x9e3779b9u * (i + 1);
+    }
+    pos_ = 0;
+    Add(seed);
+  }
+
+  void Add(uint32_t x) {
+    uint32_t& word = pool_[pos_];
+    word ^= x + 0x9e3779b9u + (word << 6) + (word >> 2);
+    pos_ = (pos_ + 1) % kSize;
+  }
+
+  // A well-mixed 32-bit seed. Taking one changes the pool, so consecutive
+  // seeds differ even with no new input in between.
+  uint32_t Take() {
+    uint32_t h = 0;
+    for (int i = 0; i < kSize; i++) {
+      h = Finalize(h ^ pool_[i]);
+    }
+    Add(h);
+    return h;
+  }
+
+ private:
+  static constexpr int kSize = 4;
+
+  // MurmurHash3's 32-bit finalizer
+  static uint32_t Finalize(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  uint32_t pool_[kSize] = {};
+  int pos_ = 0;
+};
@@ -0,0 +1,186 @@
+#include "gesture_recorder.h"
+
+#include <cstring>
+
+namespace {
+constexpr uint32_t kMagic = 0x5247534bu;  // "KSGR"
+// Bump when the encoding changes
+constexpr uint16_t kVersion = 1;
+
+constexpr uint8_t kButtonsChanged = 0x80;
+static_assert(ControlFrame::MAX_ADC_CHANNELS < 8, "a flag bit per channel and one for the buttons");
+
+struct Header {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t num_adc_channels;
+  uint8_t num_buttons;
+  uint32_t seed;
+  uint32_t sample_rate;
+  uint32_t block_size;
+  uint32_t length;  // Bytes of frames after the header
+};
+
+// Flags, four clock varints and a varint per channel, at up to 5 bytes
+// each, and the buttons
+constexpr size_t kMaxFrameBytes = 1 + 4 * 5 + ControlFrame::MAX_ADC_CHANNELS * 5 + 1;
+
+uint32_t ZigZag(uint32_t delta) {
+  const int32_t d = static_cast<int32_t>(delta);
+  return (static_cast<uint32_t>(d) << 1) ^ static_cast<uint32_t>(d >> 31);
+}
+
+uint32_t UnZigZag(uint32_t z) { return (z >> 1) ^ (0u - (z & 1)); }
+
+uint8_t* PutVarint(uint8_t* out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+  return out;
+}
+
+// Returns false if the varint runs past end
+bool GetVarint(const uint8_t*& in, const uint8_t* end, uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35 && in < end; shift += 7) {
+    const uint8_t byte = *in++;
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+bool GestureRecorder::Start(uint8_t* buffer, size_t size, uint32_t seed, uint32_t sample_rate, uint32_t block_size,
+                            int num_adc_channels, int num_buttons) {
+  buffer_ = nullptr;
+  pos_ = 0;
+  if (size < sizeof(Header) || num_adc_channels > ControlFrame::MAX_ADC_CHANNELS ||
+      num_buttons > ControlFrame::MAX_BUTTONS) {
+    return false;
+  }
+  Header header = {};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.num_adc_channels = static_cast<uint8_t>(num_adc_channels);
+  header.num_buttons = static_cast<uint8_t>(num_buttons);
+  header.seed = seed;
+  header.sample_rate = sample_rate;
+  header.block_size = block_size;
+  header.length = 0;
+  memcpy(buffer, &header, sizeof(header));
+
+  buffer_ = buffer;
+  size_ = size;
+  pos_ = sizeof(Header);
+  num_adc_channels_ = num_adc_channels;
+  first_ = true;
+  memset(&last_, 0, sizeof(last_));
+  us_step_ = 0;
+  clock_step_ = 0;
+  return true;
+}
+
+bool GestureRecorder::Record(const ControlFrame& frame) {
+  if (!buffer_ || size_ - pos_ < kMaxFrameBytes) {
+    return false;
+  }
+  uint8_t* const start = buffer_ + pos_;
+  uint8_t flags = 0;
+  uint8_t* out = start + 1;
+
+  const uint32_t us_step = frame.us - last_.us;
+  const uint32_t clock_step = frame.clock - last_.clock;
+  out = PutVarint(out, frame.ms - last_.ms);
+  out = PutVarint(out, ZigZag(us_step - us_step_));
+  out = PutVarint(out, ZigZag(clock_step - clock_step_));
+  out = PutVarint(out, ZigZag(frame.sample_time - frame.clock));
+  for (int c = 0; c < num_adc_channels_; c++) {
+    if (first_ || frame.adc[c] != last_.adc[c]) {
+      flags |= 1u << c;
+      out = PutVarint(out, ZigZag(static_cast<uint32_t>(frame.adc[c] - last_.adc[c])));
+    }
+  }
+  if (first_ || frame.buttons != last_.buttons) {
+    flags |= kButtonsChanged;
+    *out++ = frame.buttons;
+  }
+  *start = flags;
+
+  pos_ = out - buffer_;
+  const uint32_t length = static_cast<uint32_t>(pos_ - sizeof(Header));
+  memcpy(buffer_ + offsetof(Header, length), &length, sizeof(length));
+  first_ = false;
+  last_ = frame;
+  us_step_ = us_step;
+  clock_step_ = clock_step;
+  return true;
+}
+
+bool GesturePlayer::Open(const uint8_t* data, size_t size) {
+  pos_ = end_ = nullptr;
+  Header header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion || header.length > size - sizeof(header) ||
+      header.num_adc_channels > ControlFrame::MAX_ADC_CHANNELS || header.num_buttons > ControlFrame::MAX_BUTTONS) {
+    return false;
+  }
+  pos_ = data + sizeof(header);
+  end_ = pos_ + header.length;
+  seed_ = header.seed;
+  sample_rate_ = header.sample_rate;
+  block_size_ = header.block_size;
+  num_adc_channels_ = header.num_adc_channels;
+  num_buttons_ = header.num_buttons;
+  memset(&last_, 0, sizeof(last_));
+  us_step_ = 0;
+  clock_step_ = 0;
+  return true;
+}
+
+bool GesturePlayer::Next(ControlFrame& frame) {
+  if (pos_ >= end_) {
+    return false;
+  }
+  const uint8_t* in = pos_;
+  const uint8_t flags = *in++;
+  uint32_t ms_step, us_change, clock_change, offset;
+  if (!GetVarint(in, end_, ms_step) || !GetVarint(in, end_, us_change) || !GetVarint(in, end_, clock_change) ||
+      !GetVarint(in, end_, offset)) {
+    return false;
+  }
+  frame = last_;
+  us_step_ += UnZigZag(us_change);
+  clock_step_ += UnZigZag(clock_change);
+  frame.ms += ms_step;
+  frame.us += us_step_;
+  frame.clock += clock_step_;
+  frame.sample_time = frame.clock + UnZigZag(offset);
+  for (int c = 0; c < num_adc_channels_; c++) {
+    uint32_t delta;
+    if (!(flags & (1u << c))) {
+      continue;
+    }
+    if (!GetVarint(in, end_, delta)) {
+      return false;
+    }
+    frame.adc[c] = static_cast<uint16_t>(frame.adc[c] + UnZigZag(delta));
+  }
+  if (flags & kButtonsChanged) {
+    if (in >= end_) {
+      return false;
+    }
+    frame.buttons = *in++;
+  }
+
+  pos_ = in;
+  last_ = frame;
+  return true;
+}
@@ -0,0 +1,91 @@
+// Recording of the controls as played, for replaying on the host.
+//
+// Once per control tick the main loop records everything UpdateControls()
+// reads from the hardware: the millisecond and microsecond clocks, the raw
+// ADC readings, the button pin levels, and the engine's sample clock and
+// the time control changes are stamped with. Fed back in the same order
+// through the same code, with the seed the patterns were set up from, the
+// frames reproduce the run exactly (host/render.cpp -p).
+//
+// Frames are delta-encoded, as most of them differ from the last by a
+// millisecond and a little ADC noise. Each starts with a byte of flags, a
+// bit for each ADC channel that changed and one for the buttons, followed
+// by varints: the milliseconds since the last frame, the change in the
+// microsecond and sample clocks' steps since the last frame (zigzag, 0 for
+// a steady tick), how far past the sample clock the changes are stamped,
+// then a zigzag delta for each channel that changed and a byte of button
+// levels if they changed. A steady tick with still knobs is five bytes.
+//
+// The recording is a header followed by the frames, in a buffer the caller
+// provides. It stops at the last frame that fits, and the header always
+// holds the length so far, so the buffer can be copied out at any time.
+//
+// Build with -DKIDSYNTH_RECORD=1 (make RECORD=1) to record on the Seed.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#ifndef KIDSYNTH_RECORD
+#define KIDSYNTH_RECORD 0
+#endif
+
+struct ControlFrame {
+  static constexpr int MAX_ADC_CHANNELS = 7;
+  static constexpr int MAX_BUTTONS = 8;
+
+  uint32_t ms;           // System::GetNow()
+  uint32_t us;           // System::GetUs()
+  uint32_t clock;        // Engine sample clock, the next block to play
+  uint32_t sample_time;  // Stamped on the tick's control changes
+  uint16_t adc[MAX_ADC_CHANNELS];  // Raw readings
+  uint8_t buttons;       // A bit per button, set while pressed
+};
+
+class GestureRecorder {
+ public:
+  // Starts recording into size bytes of buffer, which must outlive the
+  // recording. Returns false if it can't hold the header.
+  bool Start(uint8_t* buffer, size_t size, uint32_t seed, uint32_t sample_rate, uint32_t block_size,
+             int num_adc_channels, int num_buttons);
+  // Appends a frame. Returns false once the buffer is full.
+  bool Record(const ControlFrame& frame);
+  // Bytes recorded, header included
+  size_t Size() const { return pos_; }
+
+ private:
+  uint8_t* buffer_ = nullptr;
+  size_t size_ = 0;
+  size_t pos_ = 0;
+  int num_adc_channels_ = 0;
+  bool first_ = true;
+  ControlFrame last_;
+  uint32_t us_step_ = 0;
+  uint32_t clock_step_ = 0;
+};
+
+class GesturePlayer {
+ public:
+  // Returns false if data isn't a recording, or is cut short
+  bool Open(const uint8_t* data, size_t size);
+
+  uint32_t Seed() const { return seed_; }
+  uint32_t SampleRate() const { return sample_rate_; }
+  uint32_t BlockSize() const { return block_size_; }
+  int NumAdcChannels() const { return num_adc_channels_; }
+  int NumButtons() const { return num_buttons_; }
+
+  // The next frame. Returns false at the end of the recording.
+  bool Next(ControlFrame& frame);
+
+ private:
+  const uint8_t* pos_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  uint32_t seed_ = 0;
+  uint32_t sample_rate_ = 0;
+  uint32_t block_size_ = 0;
+  int num_adc_channels_ = 0;
+  int num_buttons_ = 0;
+  ControlFrame last_;
+  uint32_t us_step_ = 0;
+  uint32_t clock_step_ = 0;
+};
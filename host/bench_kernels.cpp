@@ -0,0 +1,449 @@
+// Per-kernel micro-benchmarks for the audio hot path.
+//
+// Times each block pass of KidSynth::Process on its own, using the engine's
+// own oscillator, filter and effect objects, across a range of block sizes. Each
+// row reports nanoseconds and cycles per sample; output is CSV by default or
+// JSON with -f json, so runs can be diffed between commits. The saturation
+// curves and FastExp2() are also checked against their documented error
+// bounds, and the pattern bank against saving into a full bank.
+//
+//   kidsynth_bench [-f csv|json] [-o out_file] [-B 1,2,4,...,256]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "cycle_counter.h"
+#include "daisysp.h"
+#include "pattern_bank.h"
+#include "pitch.h"
+#include "synth_engine.h"
+#include "zdf_filter.h"
+
+namespace {
+// Cutoff and resonance for the standalone filter stages
+float filter_cutoff[KidSynth::MAX_BLOCK_SIZE];
+float filter_res[KidSynth::MAX_BLOCK_SIZE];
+
+// A single ZDF filter built from zdf_filter.h, as it ran before the voices
+// moved onto lanes of filter state; kept here as the reference kernel
+class ZdfSvf {
+ public:
+  void Init(float sample_rate) {
+    pi_over_sr_ = static_cast<float>(M_PI) / sample_rate;
+    // Same ceiling as daisysp::Svf, which also keeps FastTan in range
+    fc_max_ = sample_rate / 3.0f;
+    ic1eq_ = ic2eq_ = band_ = 0.0f;
+  }
+
+  // Low-pass a block with per-sample cutoff (Hz) and resonance (0-1)
+  // buffers. in and out may alias.
+  void ProcessLow(const float* in, const float* cutoff_hz, const float* res, float* out, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+      const float g = FastTan(FastClamp(cutoff_hz[i], 1.0f, fc_max_) * pi_over_sr_);
+      out[i] = ZdfTick(in[i], g, ZdfDamping(res[i]), ZdfDrive(res[i]), ic1eq_, ic2eq_, band_);
+    }
+  }
+
+ private:
+  float pi_over_sr_ = 0.0f;
+  float fc_max_ = 16000.0f;
+  float ic1eq_ = 0.0f;
+  float ic2eq_ = 0.0f;
+  float band_ = 0.0f;
+};
+}  // namespace
+
+struct KernelBench {
+  typedef void (*Kernel)(KidSynth& s, const float* in, float* out, size_t n);
+
+  // Fill the modulation buffers the later passes read, as if the clock and
+  // modulation passes had just run, and start a held note on every voice
+  static void Prime(KidSynth& s, const float* in) {
+    for(size_t i = 0; i < KidSynth::MAX_BLOCK_SIZE; i++) {
+      s.cutoff_buf_[i] = 1000.0f;
+      s.bend_buf_[i] = 1.0f;
+      filter_cutoff[i] = 1000.0f + 800.0f * sinf(i * 0.01f);
+      filter_res[i] = 0.5f;
+    }
+    s.num_step_events_ = 0;
+    s.sustain_samples_ = 1.0e9f;
+    s.ApplyParam(KidSynth::PARAM_DETUNE_MOD, 0.5f);
+    for(int v = 0; v < VoicePool::MAX_VOICES; v++)
+      s.voices_.NoteOn(110.0f * (v + 1), 0.8f);
+  }
+
+  static VoicePool::Params Params(KidSynth& s) {
+    return s.VoiceParams(KidSynth::WAVEFORM_SAW_SUB, s.saturation_curve_);
+  }
+
+  // Cutoff smoothing and a settled pitch bend
+  static void Modulation(KidSynth& s, const float* in, float* out, size_t n) { s.ModulationPass(n); }
+
+  // The same with the pitch bend gliding, so every sample is retuned
+  static void ModulationBend(KidSynth& s, const float* in, float* out, size_t n) {
+    s.bend_smoother_.Reset(0.0f);
+    s.pitch_bend_target_ = 12.0f;
+    s.ModulationPass(n);
+  }
+
+  // All voices' oscillator trios
+  static void VoiceOscillators(KidSynth& s, const float* in, float* out, size_t n) {
+    s.voices_.OscillatorPass(Params(s), s.bend_buf_, n);
+  }
+
+  // Oscillator drive and mix, all voices
+  static void VoiceDriveMix(KidSynth& s, const float* in, float* out, size_t n) {
+    s.voices_.MixPass(Params(s), n);
+  }
+
+  // Envelope, modulated ZDF filter and amp for all voices, plus the sum
+  static void VoiceFilterAmp(KidSynth& s, const float* in, float* out, size_t n) {
+    s.voices_.VoiceFilterAmpPass(Params(s), s.cutoff_buf_, out, n);
+  }
+
+  // The whole voice pool, all voices sounding
+  static void Voices(KidSynth& s, const float* in, float* out, size_t n) {
+    s.voices_.Render(Params(s), s.bend_buf_, s.cutoff_buf_, out, n);
+  }
+
+  // The same, with the modulation matrix evaluated every control interval
+  static void VoicesMatrix(KidSynth& s, const float* in, float* out, size_t n) {
+    s.VoicePass(out, n, KidSynth::WAVEFORM_SAW_SUB, s.saturation_curve_);
+  }
+
+  // libm tanhf, the baseline for the saturation curves
+  static void Tanhf(KidSynth& s, const float* in, float* out, size_t n) {
+    for(size_t i = 0; i < n; i++)
+      out[i] = tanhf(in[i] * 2.0f);
+  }
+
+  // libm powf against FastExp2 for semitone to frequency ratio conversion
+  static void Exp2Powf(KidSynth& s, const float* in, float* out, size_t n) {
+    for(size_t i = 0; i < n; i++)
+      out[i] = powf(2.0f, in[i] * 24.0f / 12.0f);
+  }
+
+  static void Exp2Fast(KidSynth& s, const float* in, float* out, size_t n) {
+    for(size_t i = 0; i < n; i++)
+      out[i] = SemitonesToRatio(in[i] * 24.0f);
+  }
+
+  template <SaturationCurve curve>
+  static void Saturation(KidSynth& s, const float* in, float* out, size_t n) {
+    SaturateBlock<curve>(in, out, n, 2.0f);
+  }
+
+  // daisysp::Svf with per-sample SetFreq/SetRes, the filter the ZDF one
+  // replaced
+  static void DaisySvf(KidSynth& s, const float* in, float* out, size_t n) {
+    static daisysp::Svf svf;
+    static bool init = false;
+    if(!init) {
+      svf.Init(s.sample_rate_);
+      init = true;
+    }
+    for(size_t i = 0; i < n; i++) {
+      svf.SetFreq(filter_cutoff[i]);
+      svf.SetRes(filter_res[i]);
+      svf.Process(in[i]);
+      out[i] = svf.Low();
+    }
+  }
+
+  // One ZdfSvf on the same buffers
+  static void ZdfFilter(KidSynth& s, const float* in, float* out, size_t n) {
+    static ZdfSvf svf;
+    static bool init = false;
+    if(!init) {
+      svf.Init(s.sample_rate_);
+      init = true;
+    }
+    svf.ProcessLow(in, filter_cutoff, filter_res, out, n);
+  }
+
+  static void Bitcrush(KidSynth& s, const float* in, float* out, size_t n) {
+    std::copy(in, in + n, out);
+    s.BitcrushPass<EFFECT_ON>(out, n, 1);
+  }
+
+  // Bitcrush and saturation with the oversampling around them
+  template <int factor>
+  static void Nonlinear(KidSynth& s, const float* in, float* out, size_t n) {
+    if(s.oversampler_.Factor() != factor)
+      s.UpdateOversampling(factor);
+    std::copy(in, in + n, out);
+    s.NonlinearPass<EFFECT_ON>(out, n, s.saturation_curve_);
+  }
+
+  // The saturation on the voice mix
+  static void PostSaturation(KidSynth& s, const float* in, float* out, size_t n) {
+    std::copy(in, in + n, out);
+    s.SaturationPass(out, n, s.saturation_curve_);
+  }
+
+  static void Delay(KidSynth& s, const float* in, float* out, size_t n) {
+    std::copy(in, in + n, out);
+    s.DelayPass<EFFECT_ON>(out, n);
+  }
+
+  // DcBlock, the hiss low-pass and master gain
+  static void Output(KidSynth& s, const float* in, float* out, size_t n) {
+    std::copy(in, in + n, out);
+    s.OutputPass(out, n);
+  }
+
+  static void Clock(KidSynth& s, const float* in, float* out, size_t n) { s.ClockPass(n); }
+
+  // Everything together, for reference
+  static void FullChain(KidSynth& s, const float* in, float* out, size_t n) { s.Process(out, n); }
+};
+
+namespace {
+
+constexpr size_t kMaxBlockSize = KidSynth::MAX_BLOCK_SIZE;
+constexpr size_t kInputLength = 4096;
+constexpr size_t kSamplesPerTrial = 1 << 17;
+constexpr int kTrials = 7;
+
+struct Stage {
+  const char* name;
+  KernelBench::Kernel kernel;
+};
+
+const Stage kStages[] = {
+  {"clock", KernelBench::Clock},
+  {"modulation", KernelBench::Modulation},
+  {"modulation_bend", KernelBench::ModulationBend},
+  {"voice_oscillators", KernelBench::VoiceOscillators},
+  {"voice_drive_mix", KernelBench::VoiceDriveMix},
+  {"voice_filter_amp", KernelBench::VoiceFilterAmp},
+  {"voices", KernelBench::Voices},
+  {"voices_matrix", KernelBench::VoicesMatrix},
+  {"svf_daisysp", KernelBench::DaisySvf},
+  {"svf_zdf", KernelBench::ZdfFilter},
+  {"bitcrush", KernelBench::Bitcrush},
+  {"saturation", KernelBench::PostSaturation},
+  {"nonlinear_1x", KernelBench::Nonlinear<1>},
+  {"nonlinear_2x", KernelBench::Nonlinear<2>},
+  {"nonlinear_4x", KernelBench::Nonlinear<4>},
+  {"delay_read_write", KernelBench::Delay},
+  {"dcblock_output", KernelBench::Output},
+  {"full_chain", KernelBench::FullChain},
+  {"saturate_tanhf", KernelBench::Tanhf},
+  {"saturate_pade", KernelBench::Saturation<SATURATION_PADE>},
+  {"saturate_table", KernelBench::Saturation<SATURATION_TABLE>},
+  {"saturate_cubic", KernelBench::Saturation<SATURATION_CUBIC>},
+  {"exp2_powf", KernelBench::Exp2Powf},
+  {"exp2_fast", KernelBench::Exp2Fast},
+};
+
+const char* const kCurveNames[NUM_SATURATION_CURVES] = {"pade", "table", "cubic"};
+
+struct Result {
+  const char* stage;
+  size_t block_size;
+  double ns_per_sample;
+  double cycles_per_sample;
+};
+
+volatile float sink;
+
+// Best of kTrials, so scheduler noise doesn't end up in the numbers
+Result Measure(const Stage& stage, KidSynth& synth, const float* input, size_t block_size) {
+  static float out[kMaxBlockSize];
+  const size_t blocks = kSamplesPerTrial / block_size;
+  const size_t samples = blocks * block_size;
+  double best_ns = 1e30, best_cycles = 1e30;
+  for(int trial = 0; trial < kTrials; trial++) {
+    size_t offset = 0;
+    uint64_t t0 = ReadNanoseconds();
+    uint64_t c0 = ReadCycles();
+    for(size_t b = 0; b < blocks; b++) {
+      stage.kernel(synth, input + offset, out, block_size);
+      offset += block_size;
+      if(offset + kMaxBlockSize > kInputLength)
+        offset = 0;
+    }
+    uint64_t c1 = ReadCycles();
+    uint64_t t1 = ReadNanoseconds();
+    sink = out[0];
+    best_ns = std::min(best_ns, static_cast<double>(t1 - t0) / samples);
+    best_cycles = std::min(best_cycles, static_cast<double>(c1 - c0) / samples);
+  }
+  return {stage.name, block_size, best_ns, best_cycles};
+}
+
+// Sweeps every saturation curve against tanhf and checks the documented
+// error bound; the result goes to stderr so the timing output stays clean
+bool CheckSaturationBounds() {
+  bool ok = true;
+  for(int c = 0; c < NUM_SATURATION_CURVES; c++) {
+    SaturationCurve curve = static_cast<SaturationCurve>(c);
+    float max_error = 0.0f;
+    for(int i = -2000000; i <= 2000000; i++) {
+      float x = i * 1.0e-5f;
+      float y;
+      SaturateBlock(curve, &x, &y, 1);
+      max_error = std::max(max_error, fabsf(y - tanhf(x)));
+    }
+    bool within = max_error <= SaturationMaxError(curve);
+    fprintf(stderr, "saturation %-5s max error %.3g (bound %.3g) %s\n", kCurveNames[c], max_error,
+            SaturationMaxError(curve), within ? "ok" : "FAIL");
+    ok = ok && within;
+  }
+  return ok;
+}
+
+// Same for FastExp2 over the pitch bend range and the MIDI note table
+bool CheckPitchBounds() {
+  double max_error = 0.0;
+  for(int i = -400000; i <= 400000; i++) {
+    float x = i * 1.0e-5f;
+    double exact = exp2(static_cast<double>(x));
+    max_error = std::max(max_error, fabs(FastExp2(x) - exact) / exact);
+  }
+  for(int note = 0; note < 128; note++) {
+    double exact = 440.0 * exp2((note - 69) / 12.0);
+    max_error = std::max(max_error, fabs(MidiToFreq(note) - exact) / exact);
+  }
+  bool within = max_error <= kFastExp2MaxRelError;
+  fprintf(stderr, "exp2 max relative error %.3g (bound %.3g) %s\n", max_error, kFastExp2MaxRelError,
+          within ? "ok" : "FAIL");
+  return within;
+}
+
+// Saves one pattern more than the bank holds, as holding the sequence
+// button does, and checks the oldest slot is reused and leaves the song
+bool CheckPatternBank() {
+  static PatternBank bank;
+  PatternGenerator generator;
+  generator.Init(1);
+  bank.Init();
+  Pattern pattern;
+  for(int i = 0; i < PatternBank::NUM_SLOTS; i++) {
+    generator.Generate(pattern);
+    const int slot = bank.NextSlot();
+    bank.Store(slot, pattern);
+    bank.AppendToSong(slot);
+  }
+  generator.Generate(pattern, Pattern::MAX_STEPS);
+  const int slot = bank.NextSlot();
+  bool ok = slot == 0 && bank.Store(slot, pattern) && bank.SongLength() == PatternBank::NUM_SLOTS - 1;
+  for(int i = 0; ok && i < bank.SongLength(); i++)
+    ok = bank.SongSlot(i) != slot;
+  ok = ok && bank.AppendToSong(slot) && bank.SongSlot(bank.SongLength() - 1) == slot;
+
+  // And that it survives the trip through flash
+  static PatternBank loaded;
+  Pattern recalled;
+  ok = ok && loaded.Load(bank.Image()) && loaded.SongLength() == PatternBank::NUM_SLOTS &&
+       loaded.Recall(slot, recalled) && recalled.length == Pattern::MAX_STEPS &&
+       memcmp(recalled.note, pattern.note, sizeof(pattern.note)) == 0;
+  fprintf(stderr, "pattern bank save when full %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+std::vector<size_t> ParseBlockSizes(const char* arg) {
+  std::vector<size_t> sizes;
+  const char* p = arg;
+  while(*p) {
+    char* end;
+    unsigned long v = strtoul(p, &end, 10);
+    if(end == p)
+      break;
+    if(v > 0 && v <= kMaxBlockSize)
+      sizes.push_back(v);
+    p = (*end == ',') ? end + 1 : end;
+  }
+  return sizes;
+}
+
+void Usage() { fprintf(stderr, "usage: kidsynth_bench [-f csv|json] [-o out_file] [-B block,sizes,...]\n"); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool json = false;
+  const char* out_path = nullptr;
+  std::vector<size_t> block_sizes = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+
+  for(int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if(!val || arg[0] != '-' || strlen(arg) != 2) {
+      Usage();
+      return 1;
+    }
+    switch(arg[1]) {
+      case 'f':
+        if(strcmp(val, "json") != 0 && strcmp(val, "csv") != 0) {
+          Usage();
+          return 1;
+        }
+        json = strcmp(val, "json") == 0;
+        break;
+      case 'o': out_path = val; break;
+      case 'B': block_sizes = ParseBlockSizes(val); break;
+      default: Usage(); return 1;
+    }
+    i++;
+  }
+
+  // Input that looks like the oscillator mix: two detuned saws, scaled to
+  // the level the filter normally sees
+  static float input[kInputLength];
+  for(size_t i = 0; i < kInputLength; i++) {
+    float a = fmodf(i * (110.0f / 48000.0f), 1.0f);
+    float b = fmodf(i * (110.55f / 48000.0f), 1.0f);
+    input[i] = (a - 0.5f) * 0.2f + (b - 0.5f) * 0.12f;
+  }
+
+  std::unique_ptr<KidSynth> synth(new KidSynth);
+  std::unique_ptr<int16_t[]> delay_buffer(new int16_t[KidSynth::DELAY_BUFFER_SIZE]);
+  synth->SetDelayEnabled(true);
+  synth->SetBitcrushEnabled(true);
+  synth->SetSustain(0.5f);
+
+  std::vector<Result> results;
+  for(const Stage& stage : kStages) {
+    for(size_t bs : block_sizes) {
+      // Fresh, running state for every measurement
+      synth->Init(48000.0f, delay_buffer.get(), KidSynth::DELAY_BUFFER_SIZE);
+      synth->Seed(1);
+      synth->GenerateSequence();
+      synth->SetPitchBend(0.0f);
+      KernelBench::Prime(*synth, input);
+      results.push_back(Measure(stage, *synth, input, bs));
+    }
+  }
+
+  FILE* out = out_path ? fopen(out_path, "w") : stdout;
+  if(!out) {
+    fprintf(stderr, "can't write %s\n", out_path);
+    return 1;
+  }
+  if(json) {
+    fprintf(out, "{\n  \"cycle_counter\": \"%s\",\n  \"results\": [\n",
+            KIDSYNTH_HAVE_CYCLE_COUNTER ? "tsc" : "none");
+    for(size_t i = 0; i < results.size(); i++) {
+      const Result& r = results[i];
+      fprintf(out, "    {\"stage\": \"%s\", \"block_size\": %zu, \"ns_per_sample\": %.3f, \"cycles_per_sample\": %.3f}%s\n",
+              r.stage, r.block_size, r.ns_per_sample, r.cycles_per_sample, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+  } else {
+    fprintf(out, "stage,block_size,ns_per_sample,cycles_per_sample\n");
+    for(const Result& r : results)
+      fprintf(out, "%s,%zu,%.3f,%.3f\n", r.stage, r.block_size, r.ns_per_sample, r.cycles_per_sample);
+  }
+  if(out != stdout)
+    fclose(out);
+  bool ok = CheckSaturationBounds();
+  ok = CheckPitchBounds() && ok;
+  ok = CheckPatternBank() && ok;
+  return ok ? 0 : 1;
+}
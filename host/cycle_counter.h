@@ -0,0 +1,29 @@
+// Cycle and wall-clock timing for the host benchmarks.
+//
+// On x86 the time stamp counter is used; it ticks at the nominal clock rate
+// rather than the current core clock, so treat cycle figures as reference
+// cycles. Elsewhere cycles are reported as zero.
+#pragma once
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define KIDSYNTH_HAVE_CYCLE_COUNTER 1
+#else
+#define KIDSYNTH_HAVE_CYCLE_COUNTER 0
+#endif
+
+inline uint64_t ReadCycles() {
+#if KIDSYNTH_HAVE_CYCLE_COUNTER
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+inline uint64_t ReadNanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
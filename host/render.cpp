@@ -0,0 +1,539 @@
+// Offline renderer for the KidSynth DSP chain.
+//
+// Runs KidSynth.cpp against the stubbed hardware in stubs/, feeding scripted
+// knob/button values through the same UpdateControls() path the main loop
+// uses, and writes the result to a WAV file. Afterwards the same render is
+// repeated at a range of block sizes to report throughput.
+//
+//   kidsynth_render [-d seconds] [-s seed] [-r sample_rate] [-b block_size]
+//                   [-o out.wav] [-c script.txt] [-f flash.bin]
+//                   [-t trace.csv] [-p replay.ksg] [-R record.ksg]
+//                   [-B 1,4,16,48,256]
+//
+// The sample rate is 32000, 48000 (the default) or 96000.
+//
+// -f keeps the QSPI flash in a file, so patterns saved by holding the
+// sequence button are there for the next render, which starts from the one
+// saved last like the hardware does. Without it flash starts out erased.
+// Every run here starts from the file as it was; the first run's flash is
+// written back.
+//
+// -p replays a control recording (gesture_recorder.h) in place of the
+// script: every control tick goes through the same code at the same point
+// in the audio as when it was recorded, with the recorded inputs, clocks,
+// seed and sample rate. The block size defaults to the recorded one and the
+// render to the end of the recording. Give -f the flash
+// the recording started from, if it booted from a saved pattern. -R writes
+// the first render's controls as a recording; replaying one while
+// recording gives the same file back.
+//
+// -t writes the event trace of the first render (see trace.h) as CSV: the
+// sample time, the event, its argument and its value. The rings are read
+// once per control tick, as the main loop would, so records from the engine
+// and from the buttons can be a tick out of order.
+//
+// Script lines are "<seconds> <control> <value>". Knobs (tempo, cutoff,
+// osc_mod, sustain, attack_mod, softpot) take a 0-1 position, buttons
+// (delay, double_tempo, bitcrush, waveform, sequence, swing) take 1 for
+// pressed and 0 for released. '#' starts a comment.
+//
+// The CPU profile of the first render (see profiler.h) is printed per pass,
+// as time per callback and as a share of the real-time budget.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "audio_config.h"
+#include "daisy_seed.h"
+#include "gesture_recorder.h"
+#include "synth_engine.h"
+#include "wav_writer.h"
+
+using namespace daisy;
+
+// Entry points provided by KidSynth.cpp
+extern DaisySeed hw;
+extern KidSynth synth;
+void SetupSynth();
+void SetupButtons();
+void SetupKnobs();
+void SetupPatterns(uint32_t seed);
+bool SetupSavedPatterns(uint32_t seed);
+void UpdateControls();
+void UpdateControlsAt(uint32_t clock, uint32_t time);
+#if KIDSYNTH_RECORD
+void StartGestureRecording(uint32_t seed);
+const uint8_t* GestureRecording(size_t& size);
+#endif
+bool ReadControlTrace(TraceRecord& record);
+void MyCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size);
+
+namespace {
+
+constexpr size_t kMaxBlockSize = 4096;
+
+struct Knob {
+  const char* name;
+  int channel;  // Matches the AdcChannel enum in KidSynth.cpp
+};
+
+constexpr Knob kKnobs[] = {
+  {"tempo", 0},
+  {"cutoff", 1},
+  {"osc_mod", 2},
+  {"sustain", 3},
+  {"attack_mod", 4},
+  {"softpot", 5},
+};
+
+struct Button {
+  const char* name;
+  Pin pin;
+};
+
+const Button kButtons[] = {
+  {"delay", seed::D1},
+  {"double_tempo", seed::D3},
+  {"bitcrush", seed::D5},
+  {"waveform", seed::D7},
+  {"sequence", seed::D9},
+  {"swing", seed::D11},
+};
+
+struct ScriptEvent {
+  double time;
+  std::string control;
+  float value;
+};
+
+// Used when no script is given: settle the knobs, then exercise each button
+// and sweep the filter and soft pot.
+const char* kDefaultScript =
+  "0.0 tempo 0.3\n"
+  "0.0 cutoff 0.6\n"
+  "0.0 osc_mod 0.5\n"
+  "0.0 sustain 0.5\n"
+  "0.0 attack_mod 0.5\n"
+  "0.0 softpot 0.0\n"
+  "2.0 delay 1\n"
+  "2.05 delay 0\n"
+  "3.0 cutoff 0.9\n"
+  "4.0 bitcrush 1\n"
+  "4.05 bitcrush 0\n"
+  "5.0 waveform 1\n"
+  "5.05 waveform 0\n"
+  "6.0 osc_mod 0.9\n"
+  "7.0 softpot 0.6\n"
+  "7.5 softpot 0.2\n"
+  "8.0 softpot 0.0\n"
+  "8.5 swing 1\n"
+  "8.55 swing 0\n";
+
+bool ParseScript(const std::string& text, std::vector<ScriptEvent>& events) {
+  size_t pos = 0;
+  int line_no = 0;
+  while(pos < text.size()) {
+    size_t end = text.find('\n', pos);
+    if(end == std::string::npos)
+      end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+    line_no++;
+
+    size_t comment = line.find('#');
+    if(comment != std::string::npos)
+      line.resize(comment);
+    if(line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+
+    double time;
+    char control[64];
+    float value;
+    if(sscanf(line.c_str(), "%lf %63s %f", &time, control, &value) != 3) {
+      fprintf(stderr, "script line %d: expected '<seconds> <control> <value>'\n", line_no);
+      return false;
+    }
+    events.push_back({time, control, value});
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const ScriptEvent& a, const ScriptEvent& b) { return a.time < b.time; });
+  return true;
+}
+
+bool ApplyEvent(const ScriptEvent& ev) {
+  for(const Knob& knob : kKnobs) {
+    if(ev.control == knob.name) {
+      // Every knob is initialized with flip = true, so invert the position
+      host::SetAdc(knob.channel, 1.0f - ev.value);
+      return true;
+    }
+  }
+  for(const Button& button : kButtons) {
+    if(ev.control == button.name) {
+      // Buttons are active low with pull-ups
+      host::SetPinLevel(button.pin, ev.value < 0.5f);
+      return true;
+    }
+  }
+  fprintf(stderr, "unknown control '%s'\n", ev.control.c_str());
+  return false;
+}
+
+// Reads a whole recording into frames
+bool LoadRecording(const char* path, GesturePlayer& player, std::vector<ControlFrame>& frames) {
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    fprintf(stderr, "can't open recording %s\n", path);
+    return false;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+
+  const int num_knobs = sizeof(kKnobs) / sizeof(kKnobs[0]);
+  const int num_buttons = sizeof(kButtons) / sizeof(kButtons[0]);
+  if(!player.Open(data.data(), data.size()) || player.NumAdcChannels() != num_knobs ||
+     player.NumButtons() != num_buttons) {
+    fprintf(stderr, "%s isn't a recording of these controls\n", path);
+    return false;
+  }
+  ControlFrame frame;
+  while(player.Next(frame))
+    frames.push_back(frame);
+  if(frames.empty()) {
+    fprintf(stderr, "%s is empty\n", path);
+    return false;
+  }
+  return true;
+}
+
+class Renderer {
+ public:
+  // Replays frames rather than the script if there are any
+  Renderer(const std::vector<ScriptEvent>& script, const std::vector<ControlFrame>& frames, uint32_t seed,
+           const std::vector<uint8_t>& flash)
+      : script_(script), frames_(frames), seed_(seed), flash_(flash) {}
+
+  // Same bring-up order as main() on the hardware
+  void Reset() {
+    host::ResetClock();
+    for(const Knob& knob : kKnobs)
+      host::SetAdc(knob.channel, 1.0f);
+    for(const Button& button : kButtons)
+      host::SetPinLevel(button.pin, true);
+    std::copy(flash_.begin(), flash_.end(), host::FlashMemory());
+    next_event_ = 0;
+    ApplyDueEvents(0.0);
+
+    SetupSynth();
+    SetupButtons();
+    SetupKnobs();
+    if(!SetupSavedPatterns(seed_))
+      SetupPatterns(seed_);
+#if KIDSYNTH_RECORD
+    StartGestureRecording(seed_);
+#endif
+    // Whatever the last render left behind
+    DrainTrace(nullptr);
+
+    position_ = 0;
+    next_control_ = 0;
+    next_frame_ = 0;
+  }
+
+  // Renders the next num_frames, interleaving 1ms control ticks exactly as
+  // the main loop would, or the recorded ones at the audio clock they ran
+  // at, and returns interleaved stereo in out.
+  void Render(float* out, size_t num_frames, size_t block_size) {
+    const float sr = hw.AudioSampleRate();
+    const uint64_t samples_per_ms = static_cast<uint64_t>(sr / 1000.0f);
+    size_t done = 0;
+    while(done < num_frames) {
+      while(next_frame_ < frames_.size() && frames_[next_frame_].clock <= position_) {
+        ApplyFrame(frames_[next_frame_]);
+        next_frame_++;
+      }
+      while(frames_.empty() && next_control_ <= position_) {
+        ApplyDueEvents(next_control_ / sr);
+        host::AdvanceMs(1);
+        UpdateControls();
+        DrainTrace(trace_);
+        next_control_ += samples_per_ms;
+      }
+
+      size_t n = std::min(block_size, num_frames - done);
+      float* outs[2] = {left_, right_};
+      MyCallback(ins_, outs, n);
+      for(size_t i = 0; i < n; i++) {
+        out[(done + i) * 2] = left_[i];
+        out[(done + i) * 2 + 1] = right_[i];
+      }
+      done += n;
+      position_ += n;
+    }
+  }
+
+  // CSV file for the trace, or nullptr to discard it
+  void SetTrace(FILE* trace) { trace_ = trace; }
+
+ private:
+  static void DrainTrace(FILE* f) {
+    TraceRecord record;
+    while(synth.ReadTrace(record) || ReadControlTrace(record)) {
+      if(f)
+        fprintf(f, "%u,%s,%u,%g\n", record.time, TraceEventName(record.event), record.arg, record.value);
+    }
+    const uint32_t dropped = synth.TakeTraceDropped();
+    if(f && dropped > 0)
+      fprintf(f, "# %u records dropped\n", dropped);
+  }
+
+  void ApplyDueEvents(double now) {
+    while(next_event_ < script_.size() && script_[next_event_].time <= now) {
+      ApplyEvent(script_[next_event_]);
+      next_event_++;
+    }
+  }
+
+  void ApplyFrame(const ControlFrame& frame) {
+    host::SetClock(frame.ms, frame.us);
+    for(const Knob& knob : kKnobs)
+      host::SetAdcRaw(knob.channel, frame.adc[knob.channel]);
+    for(size_t b = 0; b < sizeof(kButtons) / sizeof(kButtons[0]); b++)
+      host::SetPinLevel(kButtons[b].pin, !((frame.buttons >> b) & 1));
+    UpdateControlsAt(frame.clock, frame.sample_time);
+    DrainTrace(trace_);
+  }
+
+  const std::vector<ScriptEvent>& script_;
+  const std::vector<ControlFrame>& frames_;
+  uint32_t seed_;
+  const std::vector<uint8_t>& flash_;  // Contents at power-up
+  FILE* trace_ = nullptr;
+  size_t next_event_ = 0;
+  size_t next_frame_ = 0;
+  uint64_t position_ = 0;
+  uint64_t next_control_ = 0;
+
+  float silence_[kMaxBlockSize] = {};
+  const float* in_chans_[2] = {silence_, silence_};
+  AudioHandle::InputBuffer ins_ = in_chans_;
+  float left_[kMaxBlockSize];
+  float right_[kMaxBlockSize];
+};
+
+std::vector<size_t> ParseBlockSizes(const char* arg) {
+  std::vector<size_t> sizes;
+  const char* p = arg;
+  while(*p) {
+    char* end;
+    unsigned long v = strtoul(p, &end, 10);
+    if(end == p)
+      break;
+    if(v > 0 && v <= kMaxBlockSize)
+      sizes.push_back(v);
+    p = (*end == ',') ? end + 1 : end;
+  }
+  return sizes;
+}
+
+void PrintProfile(const ProfileStats& stats, size_t block_size, float sample_rate) {
+  if(stats.callbacks == 0 || stats.ticks_per_second <= 0.0f) {
+    printf("profiling compiled out\n");
+    return;
+  }
+  const float us_per_tick = 1.0e6f / stats.ticks_per_second;
+  const float budget_us = block_size * 1.0e6f / sample_rate;
+  printf("%-12s %10s %10s %10s %8s\n", "pass", "min us", "avg us", "max us", "budget");
+  for(int s = 0; s < NUM_PROFILE_STAGES; s++) {
+    const ProfileTiming& t = stats.stages[s];
+    const float avg = t.Average(stats.callbacks) * us_per_tick;
+    printf("%-12s %10.2f %10.2f %10.2f %7.1f%%\n", ProfileStageName(s), t.min * us_per_tick, avg,
+           t.max * us_per_tick, 100.0f * avg / budget_us);
+  }
+  const ProfileTiming& t = stats.callback;
+  printf("%-12s %10.2f %10.2f %10.2f %7.1f%%\n", "callback", t.min * us_per_tick,
+         t.Average(stats.callbacks) * us_per_tick, t.max * us_per_tick, 100.0f * stats.average_load);
+  printf("%u callbacks, peak load %.1f%%, %u overruns\n", stats.callbacks, 100.0f * stats.max_load,
+         stats.overruns);
+}
+
+void Usage() {
+  fprintf(stderr,
+          "usage: kidsynth_render [-d seconds] [-s seed] [-r sample_rate] [-b block_size]\n"
+          "                       [-o out.wav] [-c script.txt] [-f flash.bin]\n"
+          "                       [-t trace.csv] [-p replay.ksg] [-R record.ksg]\n"
+          "                       [-B block,sizes,...]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  float seconds = 10.0f;
+  uint32_t seed = 1;
+  float sample_rate = 48000.0f;
+  size_t block_size = 48;
+  const char* out_path = "kidsynth.wav";
+  const char* script_path = nullptr;
+  const char* flash_path = nullptr;
+  const char* trace_path = nullptr;
+  const char* replay_path = nullptr;
+  const char* record_path = nullptr;
+  bool seconds_set = false, block_size_set = false;
+  std::vector<size_t> bench_sizes = {1, 2, 4, 8, 16, 32, 48, 64, 128, 256};
+
+  for(int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if(!val || arg[0] != '-' || strlen(arg) != 2) {
+      Usage();
+      return 1;
+    }
+    switch(arg[1]) {
+      case 'd': seconds = strtof(val, nullptr); seconds_set = true; break;
+      case 's': seed = static_cast<uint32_t>(strtoul(val, nullptr, 0)); break;
+      case 'r': sample_rate = strtof(val, nullptr); break;
+      case 'b': block_size = strtoul(val, nullptr, 10); block_size_set = true; break;
+      case 'o': out_path = val; break;
+      case 'c': script_path = val; break;
+      case 'f': flash_path = val; break;
+      case 't': trace_path = val; break;
+      case 'p': replay_path = val; break;
+      case 'R': record_path = val; break;
+      case 'B': bench_sizes = ParseBlockSizes(val); break;
+      default: Usage(); return 1;
+    }
+    i++;
+  }
+
+  GesturePlayer player;
+  std::vector<ControlFrame> frames;
+  if(replay_path) {
+    if(!LoadRecording(replay_path, player, frames))
+      return 1;
+    seed = player.Seed();
+    sample_rate = static_cast<float>(player.SampleRate());
+    if(!block_size_set)
+      block_size = player.BlockSize();
+  }
+  if(block_size == 0 || block_size > kMaxBlockSize || seconds <= 0.0f || !IsSupportedSampleRate(sample_rate)) {
+    Usage();
+    return 1;
+  }
+
+  std::string script_text = kDefaultScript;
+  if(script_path) {
+    FILE* f = fopen(script_path, "rb");
+    if(!f) {
+      fprintf(stderr, "can't open script %s\n", script_path);
+      return 1;
+    }
+    script_text.clear();
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      script_text.append(buf, n);
+    fclose(f);
+  }
+  std::vector<ScriptEvent> script;
+  if(!ParseScript(script_text, script))
+    return 1;
+  for(const ScriptEvent& ev : script) {
+    if(!ApplyEvent(ev))
+      return 1;
+  }
+
+  hw.SetHostSampleRate(sample_rate);
+  const float sr = hw.AudioSampleRate();
+  // A replay runs until its last tick has gone through
+  const size_t total_frames = replay_path && !seconds_set ? frames.back().clock + block_size
+                                                          : static_cast<size_t>(seconds * sr);
+  std::vector<float> audio(total_frames * 2);
+  // A missing or short file reads as erased flash
+  std::vector<uint8_t> flash(QSPIHandle::kSize, 0xff);
+  if(flash_path) {
+    if(FILE* f = fopen(flash_path, "rb")) {
+      fread(flash.data(), 1, flash.size(), f);
+      fclose(f);
+    }
+  }
+  static Renderer renderer(script, frames, seed, flash);
+
+  FILE* trace = nullptr;
+  if(trace_path) {
+    trace = fopen(trace_path, "w");
+    if(!trace) {
+      fprintf(stderr, "can't write %s\n", trace_path);
+      return 1;
+    }
+    fprintf(trace, "time,event,arg,value\n");
+  }
+
+  hw.SetAudioBlockSize(block_size);
+  renderer.Reset();
+  renderer.SetTrace(trace);
+  renderer.Render(audio.data(), total_frames, block_size);
+  renderer.SetTrace(nullptr);
+  if(trace)
+    fclose(trace);
+
+  WavWriter wav;
+  if(!wav.Open(out_path, 2, static_cast<int>(sr))) {
+    fprintf(stderr, "can't write %s\n", out_path);
+    return 1;
+  }
+  wav.Write(audio.data(), total_frames);
+  wav.Close();
+  printf("wrote %s: %.2fs at %.0f Hz, seed %u, block %zu\n", out_path, total_frames / sr, sr, seed, block_size);
+  if(flash_path) {
+    FILE* f = fopen(flash_path, "wb");
+    if(!f || fwrite(host::FlashMemory(), 1, QSPIHandle::kSize, f) != QSPIHandle::kSize) {
+      fprintf(stderr, "can't write %s\n", flash_path);
+      if(f)
+        fclose(f);
+      return 1;
+    }
+    fclose(f);
+  }
+  if(record_path) {
+#if KIDSYNTH_RECORD
+    size_t size;
+    const uint8_t* recording = GestureRecording(size);
+    FILE* f = fopen(record_path, "wb");
+    if(!f || fwrite(recording, 1, size, f) != size) {
+      fprintf(stderr, "can't write %s\n", record_path);
+      if(f)
+        fclose(f);
+      return 1;
+    }
+    fclose(f);
+#else
+    fprintf(stderr, "recording compiled out, not writing %s\n", record_path);
+#endif
+  }
+
+  ProfileStats stats;
+  synth.ReadProfile(stats);
+  PrintProfile(stats, block_size, sr);
+
+  // Throughput: same script and seed, wall-clock time per block size
+  printf("%10s %16s %12s\n", "block", "samples/sec", "realtime");
+  for(size_t bs : bench_sizes) {
+    hw.SetAudioBlockSize(bs);
+    renderer.Reset();
+    auto start = std::chrono::steady_clock::now();
+    renderer.Render(audio.data(), total_frames, bs);
+    auto stop = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(stop - start).count();
+    double rate = total_frames / elapsed;
+    printf("%10zu %16.0f %11.1fx\n", bs, rate, rate / sr);
+  }
+  return 0;
+}
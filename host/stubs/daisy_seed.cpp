@@ -0,0 +1,136 @@
+#include "daisy_seed.h"
+
+#include <cstring>
+#include <vector>
+
+namespace daisy {
+
+namespace {
+uint64_t now_ms = 0;
+uint64_t now_us = 0;
+uint16_t adc_values[kHostMaxAdcChannels] = {};
+bool pin_levels[kHostNumPins] = {};
+bool pins_initialized = false;
+
+bool& PinLevel(Pin pin) {
+  if(!pins_initialized) {
+    // Buttons are wired with pull-ups, so an untouched pin reads high
+    for(bool& level : pin_levels)
+      level = true;
+    pins_initialized = true;
+  }
+  return pin_levels[pin.pin % kHostNumPins];
+}
+
+std::vector<uint8_t>& Flash() {
+  static std::vector<uint8_t> flash(QSPIHandle::kSize, 0xff);
+  return flash;
+}
+}  // namespace
+
+uint32_t System::GetNow() { return static_cast<uint32_t>(now_ms); }
+
+uint32_t System::GetUs() { return static_cast<uint32_t>(now_us); }
+
+void System::Delay(uint32_t delay_ms) { host::AdvanceMs(delay_ms); }
+
+void GPIO::Init(Pin p, Mode m, Pull pull, Speed speed) {
+  (void)m;
+  (void)speed;
+  pin_ = p;
+  if(pull == Pull::PULLDOWN)
+    PinLevel(pin_) = false;
+}
+
+bool GPIO::Read() { return PinLevel(pin_); }
+
+void GPIO::Write(bool state) { PinLevel(pin_) = state; }
+
+void Switch::Init(Pin pin, float update_rate, Type t, Polarity pol, Pull pu) {
+  (void)update_rate;
+  (void)t;
+  GPIO::Pull gpio_pull = pu == PULL_UP     ? GPIO::Pull::PULLUP
+                         : pu == PULL_DOWN ? GPIO::Pull::PULLDOWN
+                                           : GPIO::Pull::NOPULL;
+  hw_gpio_.Init(pin, GPIO::Mode::INPUT, gpio_pull);
+  last_update_ = System::GetNow();
+  updated_ = false;
+  state_ = 0x00;
+  flip_ = pol == POLARITY_INVERTED;
+}
+
+void Switch::Debounce() {
+  uint32_t now = System::GetNow();
+  updated_ = false;
+  if(now - last_update_ >= 1) {
+    last_update_ = now;
+    updated_ = true;
+    bool level = hw_gpio_.Read();
+    state_ = (state_ << 1) | (flip_ ? !level : level);
+  }
+}
+
+void AdcHandle::Init(AdcChannelConfig* cfg, size_t num_channels, OverSampling ovs) {
+  (void)cfg;
+  (void)ovs;
+  num_channels_ = num_channels;
+}
+
+uint16_t AdcHandle::Get(uint8_t chn) const { return adc_values[chn % kHostMaxAdcChannels]; }
+
+uint16_t* AdcHandle::GetPtr(uint8_t chn) { return &adc_values[chn % kHostMaxAdcChannels]; }
+
+QSPIHandle::Result QSPIHandle::Erase(uint32_t start_addr, uint32_t end_addr) {
+  if(start_addr > end_addr || end_addr > kSize)
+    return Result::ERR;
+  // Whole sectors, from the one start_addr is in
+  start_addr -= start_addr % kSectorSize;
+  end_addr = (end_addr + kSectorSize - 1) / kSectorSize * kSectorSize;
+  memset(Flash().data() + start_addr, 0xff, end_addr - start_addr);
+  return Result::OK;
+}
+
+QSPIHandle::Result QSPIHandle::Write(uint32_t address, uint32_t size, uint8_t* buffer) {
+  if(address > kSize || size > kSize - address)
+    return Result::ERR;
+  uint8_t* flash = Flash().data() + address;
+  for(uint32_t i = 0; i < size; i++)
+    flash[i] &= buffer[i];
+  return Result::OK;
+}
+
+void* QSPIHandle::GetData(uint32_t offset) { return Flash().data() + offset; }
+
+namespace host {
+
+void AdvanceMs(uint32_t ms) {
+  now_ms += ms;
+  now_us += static_cast<uint64_t>(ms) * 1000;
+}
+
+void ResetClock() {
+  now_ms = 0;
+  now_us = 0;
+}
+
+void SetClock(uint32_t ms, uint32_t us) {
+  now_ms = ms;
+  now_us = us;
+}
+
+void SetAdcRaw(int channel, uint16_t value) { adc_values[channel % kHostMaxAdcChannels] = value; }
+
+void SetAdc(int channel, float value) {
+  value = fminf(fmaxf(value, 0.0f), 1.0f);
+  SetAdcRaw(channel, static_cast<uint16_t>(value * 65535.0f));
+}
+
+void SetPinLevel(Pin pin, bool level) { PinLevel(pin) = level; }
+
+bool GetPinLevel(Pin pin) { return PinLevel(pin); }
+
+uint8_t* FlashMemory() { return Flash().data(); }
+
+}  // namespace host
+
+}  // namespace daisy
@@ -0,0 +1,303 @@
+// Host-side stand-in for libDaisy's daisy_seed.h.
+//
+// Only the parts of the DaisySeed / ADC / control API that KidSynth touches
+// are provided. Hardware inputs are driven from the host through the
+// daisy::host namespace at the bottom of this file, and time is a virtual
+// millisecond clock that only moves when the host advances it, so renders are
+// fully deterministic.
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace daisy {
+
+struct Pin {
+  uint8_t port;
+  uint8_t pin;
+};
+
+namespace seed {
+constexpr Pin D0 = {0, 0};
+constexpr Pin D1 = {0, 1};
+constexpr Pin D2 = {0, 2};
+constexpr Pin D3 = {0, 3};
+constexpr Pin D4 = {0, 4};
+constexpr Pin D5 = {0, 5};
+constexpr Pin D6 = {0, 6};
+constexpr Pin D7 = {0, 7};
+constexpr Pin D8 = {0, 8};
+constexpr Pin D9 = {0, 9};
+constexpr Pin D10 = {0, 10};
+constexpr Pin D11 = {0, 11};
+constexpr Pin D12 = {0, 12};
+constexpr Pin D13 = {0, 13};
+constexpr Pin D14 = {0, 14};
+constexpr Pin D15 = {0, 15};
+constexpr Pin D16 = {0, 16};
+constexpr Pin D17 = {0, 17};
+constexpr Pin D18 = {0, 18};
+constexpr Pin D19 = {0, 19};
+constexpr Pin D20 = {0, 20};
+constexpr Pin D21 = {0, 21};
+constexpr Pin D22 = {0, 22};
+constexpr Pin D23 = {0, 23};
+constexpr Pin D24 = {0, 24};
+constexpr Pin D25 = {0, 25};
+constexpr Pin D26 = {0, 26};
+constexpr Pin D27 = {0, 27};
+constexpr Pin D28 = {0, 28};
+constexpr Pin D29 = {0, 29};
+constexpr Pin D30 = {0, 30};
+
+// Same aliasing as the real Seed pinout
+constexpr Pin A0 = D15;
+constexpr Pin A1 = D16;
+constexpr Pin A2 = D17;
+constexpr Pin A3 = D18;
+constexpr Pin A4 = D19;
+constexpr Pin A5 = D20;
+constexpr Pin A6 = D21;
+constexpr Pin A7 = D22;
+constexpr Pin A8 = D23;
+constexpr Pin A9 = D24;
+constexpr Pin A10 = D25;
+constexpr Pin A11 = D28;
+}  // namespace seed
+
+constexpr int kHostNumPins = 32;
+constexpr int kHostMaxAdcChannels = 16;
+
+class System {
+ public:
+  static uint32_t GetNow();
+  static uint32_t GetUs();
+  static void Delay(uint32_t delay_ms);
+};
+
+class GPIO {
+ public:
+  enum class Mode { INPUT, OUTPUT, OPEN_DRAIN, ANALOG };
+  enum class Pull { NOPULL, PULLUP, PULLDOWN };
+  enum class Speed { LOW, MEDIUM, HIGH, VERY_HIGH };
+
+  void Init(Pin p, Mode m = Mode::INPUT, Pull pull = Pull::NOPULL, Speed speed = Speed::LOW);
+  bool Read();
+  void Write(bool state);
+  void Toggle() { Write(!Read()); }
+
+ private:
+  Pin pin_ = {0, 0};
+};
+
+class Switch {
+ public:
+  enum Type { TYPE_TOGGLE, TYPE_MOMENTARY };
+  enum Polarity { POLARITY_NORMAL, POLARITY_INVERTED };
+  enum Pull { PULL_UP, PULL_DOWN, PULL_NONE };
+
+  void Init(Pin pin, float update_rate, Type t, Polarity pol, Pull pu);
+  void Init(Pin pin, float update_rate = 0.0f) {
+    Init(pin, update_rate, TYPE_MOMENTARY, POLARITY_INVERTED, PULL_UP);
+  }
+
+  // Same shift-register debounce as libDaisy: one sample per elapsed ms
+  void Debounce();
+  bool RisingEdge() const { return updated_ ? state_ == 0x7f : false; }
+  bool FallingEdge() const { return updated_ ? state_ == 0x80 : false; }
+  bool Pressed() const { return state_ == 0xff; }
+  // The pin as it reads now, pressed or not, without debouncing
+  bool RawState() {
+    const bool level = hw_gpio_.Read();
+    return flip_ ? !level : level;
+  }
+
+ private:
+  GPIO hw_gpio_;
+  uint32_t last_update_ = 0;
+  bool updated_ = false;
+  uint8_t state_ = 0x00;
+  bool flip_ = false;
+};
+
+struct AdcChannelConfig {
+  void InitSingle(Pin pin) { pin_ = pin; }
+  Pin pin_ = {0, 0};
+};
+
+class AdcHandle {
+ public:
+  enum OverSampling { OVS_NONE, OVS_4, OVS_8, OVS_16, OVS_32, OVS_64, OVS_128, OVS_256, OVS_512, OVS_1024, OVS_LAST };
+
+  void Init(AdcChannelConfig* cfg, size_t num_channels, OverSampling ovs = OVS_32);
+  void Start() {}
+  void Stop() {}
+  uint16_t Get(uint8_t chn) const;
+  uint16_t* GetPtr(uint8_t chn);
+  float GetFloat(uint8_t chn) const { return Get(chn) / 65536.0f; }
+
+ private:
+  size_t num_channels_ = 0;
+};
+
+class AnalogControl {
+ public:
+  void Init(uint16_t* adcptr, float sr, bool flip = false, bool invert = false, float slew_seconds = 0.002f) {
+    val_ = 0.0f;
+    raw_ = adcptr;
+    samplerate_ = sr;
+    coeff_ = 1.0f / (slew_seconds * samplerate_ * 0.5f);
+    flip_ = flip;
+    invert_ = invert;
+  }
+
+  float Process() {
+    float t = *raw_ * (1.0f / 65536.0f);
+    if(flip_)
+      t = 1.0f - t;
+    if(invert_)
+      t = -t;
+    val_ += coeff_ * (t - val_);
+    return val_;
+  }
+
+  float Value() const { return val_; }
+
+ private:
+  uint16_t* raw_ = nullptr;
+  float coeff_ = 0.0f, samplerate_ = 0.0f, val_ = 0.0f;
+  bool flip_ = false, invert_ = false;
+};
+
+class Parameter {
+ public:
+  enum Curve { LINEAR, EXPONENTIAL, LOGARITHMIC, CUBE, LAST };
+
+  // Like libDaisy, the control is copied and processed again by Process()
+  void Init(AnalogControl input, float min, float max, Curve curve) {
+    pmin_ = min;
+    pmax_ = max;
+    pcurve_ = curve;
+    in_ = input;
+    lmin_ = logf(min < 0.0000001f ? 0.0000001f : min);
+    lmax_ = logf(max);
+  }
+
+  float Process() {
+    switch(pcurve_) {
+      case LINEAR: val_ = (in_.Process() * (pmax_ - pmin_)) + pmin_; break;
+      case EXPONENTIAL:
+        val_ = in_.Process();
+        val_ = ((val_ * val_) * (pmax_ - pmin_)) + pmin_;
+        break;
+      case LOGARITHMIC: val_ = expf((in_.Process() * (lmax_ - lmin_)) + lmin_); break;
+      case CUBE:
+        val_ = in_.Process();
+        val_ = ((val_ * (val_ * val_)) * (pmax_ - pmin_)) + pmin_;
+        break;
+      default: break;
+    }
+    return val_;
+  }
+
+  float Value() const { return val_; }
+
+ private:
+  AnalogControl in_;
+  float pmin_ = 0.0f, pmax_ = 1.0f, lmin_ = 0.0f, lmax_ = 0.0f, val_ = 0.0f;
+  Curve pcurve_ = LINEAR;
+};
+
+class SaiHandle {
+ public:
+  struct Config {
+    enum class SampleRate { SAI_8KHZ, SAI_16KHZ, SAI_32KHZ, SAI_48KHZ, SAI_96KHZ };
+  };
+};
+
+// The Seed's 8MB QSPI flash, in memory. Erased flash reads 0xff, Erase()
+// works in whole 4KB sectors and Write() can only clear bits, as on the
+// chip. The host sets and saves the contents through host::FlashMemory().
+class QSPIHandle {
+ public:
+  enum class Result { OK, ERR };
+
+  static constexpr uint32_t kSize = 8 * 1024 * 1024;
+  static constexpr uint32_t kSectorSize = 4096;
+
+  // Addresses are offsets from the start of the flash
+  Result Erase(uint32_t start_addr, uint32_t end_addr);
+  Result Write(uint32_t address, uint32_t size, uint8_t* buffer);
+  // Memory-mapped contents
+  void* GetData(uint32_t offset = 0);
+};
+
+class AudioHandle {
+ public:
+  typedef const float* const* InputBuffer;
+  typedef float** OutputBuffer;
+  typedef void (*AudioCallback)(InputBuffer in, OutputBuffer out, size_t size);
+};
+
+class DaisySeed {
+ public:
+  void Configure() {}
+  void Init(bool boost = false) { (void)boost; }
+  void StartLog(bool wait_for_pc = false) { (void)wait_for_pc; }
+
+  template <typename... VA>
+  static void PrintLine(const char* format, VA... va) {
+    printf(format, va...);
+    printf("\n");
+  }
+
+  void StartAudio(AudioHandle::AudioCallback cb) { callback_ = cb; }
+  void StopAudio() { callback_ = nullptr; }
+  void SetAudioSampleRate(SaiHandle::Config::SampleRate samplerate) {
+    switch(samplerate) {
+      case SaiHandle::Config::SampleRate::SAI_8KHZ: sample_rate_ = 8000.0f; break;
+      case SaiHandle::Config::SampleRate::SAI_16KHZ: sample_rate_ = 16000.0f; break;
+      case SaiHandle::Config::SampleRate::SAI_32KHZ: sample_rate_ = 32000.0f; break;
+      case SaiHandle::Config::SampleRate::SAI_96KHZ: sample_rate_ = 96000.0f; break;
+      default: sample_rate_ = 48000.0f; break;
+    }
+  }
+  void SetAudioBlockSize(size_t blocksize) { block_size_ = blocksize; }
+  size_t AudioBlockSize() const { return block_size_; }
+  float AudioSampleRate() const { return sample_rate_; }
+  float AudioCallbackRate() const { return sample_rate_ / block_size_; }
+  void SetLed(bool state) { (void)state; }
+
+  // Host only: audio format and the callback registered by StartAudio()
+  void SetHostSampleRate(float sample_rate) { sample_rate_ = sample_rate; }
+  AudioHandle::AudioCallback HostCallback() const { return callback_; }
+
+  AdcHandle adc;
+  QSPIHandle qspi;
+
+ private:
+  float sample_rate_ = 48000.0f;
+  size_t block_size_ = 48;
+  AudioHandle::AudioCallback callback_ = nullptr;
+};
+
+// Host controls for the simulated hardware
+namespace host {
+// Moves the virtual System clock forward
+void AdvanceMs(uint32_t ms);
+void ResetClock();
+// Sets the millisecond and microsecond clocks apart, as the Seed's run on
+// separate timers
+void SetClock(uint32_t ms, uint32_t us);
+// Raw 16-bit ADC reading, or a normalized 0-1 knob position
+void SetAdcRaw(int channel, uint16_t value);
+void SetAdc(int channel, float value);
+// Physical pin level; inverted switches read a low level as pressed
+void SetPinLevel(Pin pin, bool level);
+bool GetPinLevel(Pin pin);
+// The QSPI flash's contents, QSPIHandle::kSize bytes, erased to start with
+uint8_t* FlashMemory();
+}  // namespace host
+
+}  // namespace daisy
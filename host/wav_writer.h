@@ -0,0 +1,70 @@
+// Minimal streaming WAV writer for the host tools (32-bit float PCM).
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+class WavWriter {
+ public:
+  ~WavWriter() { Close(); }
+
+  bool Open(const char* path, int channels, int sample_rate) {
+    Close();
+    file_ = fopen(path, "wb");
+    if(!file_)
+      return false;
+    channels_ = channels;
+    sample_rate_ = sample_rate;
+    frames_ = 0;
+    WriteHeader();
+    return true;
+  }
+
+  // Interleaved frames
+  void Write(const float* samples, size_t frames) {
+    if(!file_)
+      return;
+    fwrite(samples, sizeof(float), frames * channels_, file_);
+    frames_ += frames;
+  }
+
+  void Close() {
+    if(!file_)
+      return;
+    // Patch the chunk sizes now that the length is known
+    fseek(file_, 0, SEEK_SET);
+    WriteHeader();
+    fclose(file_);
+    file_ = nullptr;
+  }
+
+ private:
+  void Put32(uint32_t v) {
+    uint8_t b[4] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)};
+    fwrite(b, 1, 4, file_);
+  }
+  void Put16(uint16_t v) {
+    uint8_t b[2] = {uint8_t(v), uint8_t(v >> 8)};
+    fwrite(b, 1, 2, file_);
+  }
+
+  void WriteHeader() {
+    uint32_t data_bytes = static_cast<uint32_t>(frames_ * channels_ * sizeof(float));
+    fwrite("RIFF", 1, 4, file_);
+    Put32(36 + data_bytes);
+    fwrite("WAVEfmt ", 1, 8, file_);
+    Put32(16);
+    Put16(3);  // WAVE_FORMAT_IEEE_FLOAT
+    Put16(static_cast<uint16_t>(channels_));
+    Put32(static_cast<uint32_t>(sample_rate_));
+    Put32(static_cast<uint32_t>(sample_rate_ * channels_ * sizeof(float)));
+    Put16(static_cast<uint16_t>(channels_ * sizeof(float)));
+    Put16(32);
+    fwrite("data", 1, 4, file_);
+    Put32(data_bytes);
+  }
+
+  FILE* file_ = nullptr;
+  int channels_ = 2;
+  int sample_rate_ = 48000;
+  uint64_t frames_ = 0;
+};
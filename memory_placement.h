@@ -0,0 +1,35 @@
+// Where code and data live on the Seed.
+//
+// The STM32H750 has a few small, fast memories next to the core and a large,
+// slow SDRAM. Anything not marked here goes where the default linker script
+// puts it: code in flash (behind the instruction cache), data in AXI SRAM,
+// and that SRAM fills up quickly.
+//
+//   KIDSYNTH_ITCM       64KB ITCM, zero wait state code. The audio callback
+//                       and the DSP passes it runs every block.
+//   KIDSYNTH_DTCM_BSS   128KB DTCM, zero wait state data, not reachable by
+//                       DMA. The engine's per-sample state and scratch.
+//   KIDSYNTH_SDRAM_BSS  64MB SDRAM, cached but slow on a miss. Large buffers
+//                       read a little at a time: the delay line and the
+//                       wavetables.
+//
+// The sections are the ones libDaisy's linker script defines; its startup
+// code copies .itcmram in from flash. The _BSS sections are not zeroed at
+// boot, so nothing placed there may count on starting out as zero: it has
+// to be set up by its constructor or its Init().
+//
+// "make" writes a report of what ended up where to build/KidSynth.memmap.txt.
+// On the host build all of these are empty.
+#pragma once
+
+#ifdef KIDSYNTH_HOST
+#define KIDSYNTH_ITCM
+#define KIDSYNTH_DTCM_BSS
+#define KIDSYNTH_SDRAM_BSS
+#else
+// Code inlined into an ITCM function runs from ITCM with it, so per-sample
+// helpers only need marking if they are called out of line
+#define KIDSYNTH_ITCM __attribute__((section(".itcmram")))
+#define KIDSYNTH_DTCM_BSS __attribute__((section(".dtcmram_bss")))
+#define KIDSYNTH_SDRAM_BSS __attribute__((section(".sdram_bss")))
+#endif
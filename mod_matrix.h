@@ -0,0 +1,112 @@
+// Assignable modulation routing.
+//
+// A route connects one source to one destination with an amount, and the
+// table holds up to MAX_ROUTES of them. Every value is kept per voice lane:
+// sources that are the same for every voice (LFOs, the step, the joystick)
+// are copied across the lanes, so a route is always one multiply-add over
+// all lanes. Evaluate() runs the whole table in one go; the engine calls it
+// once per control interval and lets the voices interpolate the results up
+// to audio rate.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "voice_pool.h"
+
+enum ModSource {
+  MOD_SRC_NONE,        // Empty route
+  MOD_SRC_LFO1,        // Slow sine, -1 to 1
+  MOD_SRC_LFO2,        // Faster sine, -1 to 1
+  MOD_SRC_ENVELOPE,    // The voice's envelope, 0 to 1
+  MOD_SRC_VELOCITY,    // The voice's note velocity, 0 to 1
+  MOD_SRC_STEP,        // Step of the latest note, 0 (first) to 1 (last)
+  MOD_SRC_JOYSTICK_X,  // Detune knob, -1 to 1
+  MOD_SRC_JOYSTICK_Y,  // Attack/release knob, -1 to 1
+  MOD_SRC_SOFTPOT,     // Pitch bend strip, -1 to 1, 0 when not touched
+  NUM_MOD_SOURCES
+};
+
+// What an amount of 1 means for each destination
+enum ModDestination {
+  MOD_DEST_PITCH,          // One semitone
+  MOD_DEST_CUTOFF,         // One Hz
+  MOD_DEST_RESONANCE,      // The whole resonance range
+  MOD_DEST_AMP,            // Doubles the level
+  MOD_DEST_DRIVE,          // Doubles the oscillator drive
+  MOD_DEST_DELAY_TIME,     // Doubles the delay time
+  MOD_DEST_BITCRUSH_RATE,  // Doubles the bitcrush sample rate
+  NUM_MOD_DESTINATIONS
+};
+
+struct ModRoute {
+  uint8_t source;       // ModSource
+  uint8_t destination;  // ModDestination
+  float amount;
+};
+
+class ModMatrix {
+ public:
+  static constexpr int MAX_ROUTES = 8;
+  static constexpr int LANES = VoicePool::MAX_VOICES;
+
+  // Starts with every route empty
+  ModMatrix() {
+    for (int r = 0; r < MAX_ROUTES; r++) {
+      routes_[r] = {MOD_SRC_NONE, MOD_DEST_PITCH, 0.0f};
+    }
+    for (int s = 0; s < NUM_MOD_SOURCES; s++) {
+      SetSource(static_cast<ModSource>(s), 0.0f);
+    }
+  }
+
+  // Replaces route slot, 0 to MAX_ROUTES - 1; a MOD_SRC_NONE source clears it
+  void SetRoute(int slot, const ModRoute& route) {
+    if (slot >= 0 && slot < MAX_ROUTES && route.source < NUM_MOD_SOURCES &&
+        route.destination < NUM_MOD_DESTINATIONS) {
+      routes_[slot] = route;
+    }
+  }
+  const ModRoute& Route(int slot) const { return routes_[slot]; }
+
+  // The same value for every voice
+  void SetSource(ModSource source, float value) {
+    for (int l = 0; l < LANES; l++) {
+      sources_[source][l] = value;
+    }
+  }
+  // One value per voice
+  void SetSource(ModSource source, const float* lanes) {
+    for (int l = 0; l < LANES; l++) {
+      sources_[source][l] = lanes[l];
+    }
+  }
+
+  // Sums every route into the destinations
+  void Evaluate() {
+    for (int d = 0; d < NUM_MOD_DESTINATIONS; d++) {
+      for (int l = 0; l < LANES; l++) {
+        out_[d][l] = 0.0f;
+      }
+    }
+    for (int r = 0; r < MAX_ROUTES; r++) {
+      const ModRoute& route = routes_[r];
+      if (route.source == MOD_SRC_NONE) {
+        continue;
+      }
+      const float* in = sources_[route.source];
+      float* out = out_[route.destination];
+      const float amount = route.amount;
+      for (int l = 0; l < LANES; l++) {
+        out[l] += amount * in[l];
+      }
+    }
+  }
+
+  // A destination's modulation from the last Evaluate(), one value per voice
+  const float* Output(ModDestination destination) const { return out_[destination]; }
+
+ private:
+  ModRoute routes_[MAX_ROUTES];
+  float sources_[NUM_MOD_SOURCES][LANES];
+  float out_[NUM_MOD_DESTINATIONS][LANES];
+};
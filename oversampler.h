@@ -0,0 +1,166 @@
+// 2x/4x oversampling for the nonlinear stages.
+//
+// Built from polyphase half-band IIR stages: each is two chains of
+// first-order allpasses running at the lower rate, one per polyphase
+// branch, so going up or down an octave costs one multiply per
+// coefficient per low-rate sample. Coefficients come from the elliptic
+// half-band design in Laurent de Soras' HIIR library.
+//
+//   base <-> 2x: 8 coefficients, transition 0.04, ~99 dB rejection
+//   2x <-> 4x:   4 coefficients, transition 0.25, ~117 dB rejection
+//
+// The second stage only has to reject images of audio that the first has
+// already band-limited, so it can be much shallower.
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+template <int NUM_COEFS>
+class HalfBandStage {
+ public:
+  void Init(const float* coefs) {
+    for (int i = 0; i < NUM_COEFS; i++) {
+      coefs_[i] = coefs[i];
+    }
+    Reset();
+  }
+
+  void Reset() {
+    for (int i = 0; i < NUM_COEFS; i++) {
+      x_[i] = 0.0f;
+      y_[i] = 0.0f;
+    }
+  }
+
+  // Zeroes state that has decayed to inaudible levels. Allpass state left to
+  // ring down after the input goes silent would otherwise reach denormals,
+  // which are very slow on some FPUs.
+  void FlushDenormals() {
+    for (int i = 0; i < NUM_COEFS; i++) {
+      x_[i] = fabsf(x_[i]) < 1.0e-20f ? 0.0f : x_[i];
+      y_[i] = fabsf(y_[i]) < 1.0e-20f ? 0.0f : y_[i];
+    }
+  }
+
+  // One input sample to two output samples at twice the rate
+  void Up(float in, float& out_0, float& out_1) {
+    out_0 = in;
+    out_1 = in;
+    Process(out_0, out_1);
+  }
+
+  // Two input samples to one at half the rate
+  float Down(float in_0, float in_1) {
+    float spl_0 = in_1;
+    float spl_1 = in_0;
+    Process(spl_0, spl_1);
+    return 0.5f * (spl_0 + spl_1);
+  }
+
+ private:
+  // Even coefficients filter branch 0, odd ones branch 1
+  void Process(float& spl_0, float& spl_1) {
+    for (int i = 0; i < NUM_COEFS; i += 2) {
+      float tmp_0 = (spl_0 - y_[i]) * coefs_[i] + x_[i];
+      float tmp_1 = (spl_1 - y_[i + 1]) * coefs_[i + 1] + x_[i + 1];
+      x_[i] = spl_0;
+      x_[i + 1] = spl_1;
+      y_[i] = tmp_0;
+      y_[i + 1] = tmp_1;
+      spl_0 = tmp_0;
+      spl_1 = tmp_1;
+    }
+  }
+
+  static_assert(NUM_COEFS % 2 == 0, "both branches need the same length");
+
+  float coefs_[NUM_COEFS];
+  float x_[NUM_COEFS];
+  float y_[NUM_COEFS];
+};
+
+class Oversampler {
+ public:
+  static constexpr int MAX_FACTOR = 4;
+
+  void Init() {
+    static constexpr float kInnerCoefs[8] = {
+      0.04063346092419326f, 0.1505051290226746f, 0.3007570559918741f, 0.4607745049614506f,
+      0.6095243148961883f,  0.7385038411188573f, 0.8492238103920661f, 0.9497427837050002f,
+    };
+    static constexpr float kOuterCoefs[4] = {
+      0.04245470986526757f, 0.17073985049749862f, 0.39331989319032623f, 0.7457135887202139f,
+    };
+    up_inner_.Init(kInnerCoefs);
+    down_inner_.Init(kInnerCoefs);
+    up_outer_.Init(kOuterCoefs);
+    down_outer_.Init(kOuterCoefs);
+  }
+
+  void Reset() {
+    up_inner_.Reset();
+    down_inner_.Reset();
+    up_outer_.Reset();
+    down_outer_.Reset();
+  }
+
+  // 1 (off), 2 or 4. Changing it clears the filter state.
+  void SetFactor(int factor) {
+    factor = factor >= 4 ? 4 : (factor >= 2 ? 2 : 1);
+    if (factor != factor_) {
+      factor_ = factor;
+      Reset();
+    }
+  }
+  int Factor() const { return factor_; }
+
+  // size base-rate samples in, size * Factor() out
+  void Upsample(const float* in, float* up, size_t size) {
+    if (factor_ == 1) {
+      for (size_t i = 0; i < size; i++) {
+        up[i] = in[i];
+      }
+    } else if (factor_ == 2) {
+      for (size_t i = 0; i < size; i++) {
+        up_inner_.Up(in[i], up[2 * i], up[2 * i + 1]);
+      }
+    } else {
+      for (size_t i = 0; i < size; i++) {
+        float mid_0, mid_1;
+        up_inner_.Up(in[i], mid_0, mid_1);
+        up_outer_.Up(mid_0, up[4 * i], up[4 * i + 1]);
+        up_outer_.Up(mid_1, up[4 * i + 2], up[4 * i + 3]);
+      }
+    }
+    up_inner_.FlushDenormals();
+    up_outer_.FlushDenormals();
+  }
+
+  // size * Factor() oversampled samples in, size out
+  void Downsample(const float* up, float* out, size_t size) {
+    if (factor_ == 1) {
+      for (size_t i = 0; i < size; i++) {
+        out[i] = up[i];
+      }
+    } else if (factor_ == 2) {
+      for (size_t i = 0; i < size; i++) {
+        out[i] = down_inner_.Down(up[2 * i], up[2 * i + 1]);
+      }
+    } else {
+      for (size_t i = 0; i < size; i++) {
+        float mid_0 = down_outer_.Down(up[4 * i], up[4 * i + 1]);
+        float mid_1 = down_outer_.Down(up[4 * i + 2], up[4 * i + 3]);
+        out[i] = down_inner_.Down(mid_0, mid_1);
+      }
+    }
+    down_inner_.FlushDenormals();
+    down_outer_.FlushDenormals();
+  }
+
+ private:
+  int factor_ = 1;
+  HalfBandStage<8> up_inner_;
+  HalfBandStage<8> down_inner_;
+  HalfBandStage<4> up_outer_;
+  HalfBandStage<4> down_outer_;
+};
@@ -0,0 +1,108 @@
+#include "pattern.h"
+
+#include "pitch.h"
+
+constexpr int MAJOR_SCALE[7] = {0, 2, 4, 5, 7, 9, 11};
+constexpr int MINOR_SCALE[7] = {0, 2, 3, 5, 7, 8, 10};
+
+void PatternGenerator::Init(uint32_t seed) {
+  is_bassline_ = false;
+  Seed(seed);
+}
+
+void PatternGenerator::Seed(uint32_t seed) {
+  // xorshift has a fixed point at zero
+  rng_state_ = seed ? seed : 0x9e3779b9u;
+}
+
+uint32_t PatternGenerator::Random() {
+  // xorshift32, kept per generator so patterns don't share libc rand() state
+  uint32_t x = rng_state_;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rng_state_ = x;
+  return x >> 1;
+}
+
+void PatternGenerator::Generate(Pattern& pattern, int length) {
+  length = length < 1 ? 1 : (length > Pattern::MAX_STEPS ? Pattern::MAX_STEPS : length);
+  pattern.length = length;
+  const bool is_major = Random() % 2 == 0;
+  is_bassline_ = !is_bassline_;
+  int starting_note = is_bassline_? 24 : 36;  // Shifted down one octave
+  const int key_root = starting_note + (Random() % 7);
+
+  const int* scale = is_major ? MAJOR_SCALE : MINOR_SCALE;
+  int prev_degree = 0;
+
+  // Choose melodic contour: 0=climb, 1=fall, 2=arch, 3=random walk
+  int contour = Random() % 4;
+
+  for (int i = 0; i < length; i++) {
+    int degree = 0;
+
+    // First note is always root
+    if (i == 0) {
+      degree = 0;
+    }
+    // Last note resolves
+    else if (i == length - 1) {
+      degree = (Random() % 2 == 0) ? 0 : 4;  // Root or dominant
+    }
+    // Middle notes follow contour
+    else {
+      switch(contour) {
+        case 0: // Climb up
+          degree = (i * 7) / length;
+          break;
+        case 1: // Fall down
+          degree = 6 - ((i * 6) / length);
+          break;
+        case 2: // Arch (up then down)
+          degree = (i < length/2) ? (i * 2) : (6 - (i - length/2) * 2);
+          break;
+        case 3: // Random walk
+          int step_change = (Random() % 3) - 1;
+          degree = prev_degree + step_change;
+          break;
+      }
+
+      // Allow repeated notes sometimes
+      if (Random() % 4 == 0) {
+        degree = prev_degree;
+      }
+
+      // Clamp to scale
+      if (degree < 0) degree = 0;
+      if (degree > 6) degree = 6;
+    }
+    prev_degree = degree;
+
+    // Octave jumps on strong beats (steps 0, 4)
+    int octave = 0;
+    if (!is_bassline_ && (i == 0 || i == 4) && Random() % 3 == 0) {
+      octave = 12;
+    }
+
+    int note = key_root + scale[degree] + octave;
+    pattern.note[i] = static_cast<uint8_t>(note);
+    pattern.freq[i] = MidiToFreq(note);
+
+    // Add rests: 15% chance, but never on first or last step
+    if (i > 0 && i < length - 1 && Random() % 100 < 15) {
+      pattern.is_rest[i] = true;
+    } else {
+      pattern.is_rest[i] = false;
+    }
+
+    // Velocity: accent strong beats (0, 4), softer on off-beats
+    if (i % 4 == 0) {
+      pattern.velocity[i] = 0.9f + (Random() % 10) / 100.0f;  // 0.9-1.0
+    } else if (i % 2 == 0) {
+      pattern.velocity[i] = 0.75f + (Random() % 10) / 100.0f;  // 0.75-0.85
+    } else {
+      pattern.velocity[i] = 0.6f + (Random() % 10) / 100.0f;  // 0.6-0.7
+    }
+  }
+}
@@ -0,0 +1,42 @@
+// Step patterns and the generator that composes them.
+//
+// A Pattern is plain data, small enough to copy between threads whole. Each
+// step holds what the engine needs to play it as is, so starting a note is
+// only a copy.
+// PatternGenerator writes one from its own RNG, so patterns can be composed
+// ahead of time, away from the audio callback, and handed to the engine
+// when they are wanted.
+#pragma once
+#include <cstdint>
+
+struct Pattern {
+  static constexpr int MAX_STEPS = 64;
+  static constexpr int DEFAULT_STEPS = 8;
+
+  int length;                // Steps in a bar, 1 to MAX_STEPS
+  uint8_t note[MAX_STEPS];   // MIDI note, what the pattern bank stores
+  float freq[MAX_STEPS];     // The note's frequency, worked out ahead of playback
+  bool is_rest[MAX_STEPS];   // Track which steps are silent
+  float velocity[MAX_STEPS]; // Volume per step (0.6 - 1.0)
+};
+
+class PatternGenerator {
+ public:
+  // Restarts the bassline/melody alternation and reseeds the RNG
+  void Init(uint32_t seed);
+  // Reseeds the RNG, keeping the alternation going
+  void Seed(uint32_t seed);
+  // Steps the alternation back over the last patterns composed, so they
+  // can be composed again as the same kind
+  void Rewind(int patterns) { is_bassline_ ^= (patterns & 1) != 0; }
+
+  // Composes the next pattern, length steps long; patterns alternate
+  // between a bassline and a melody
+  void Generate(Pattern& pattern, int length = Pattern::DEFAULT_STEPS);
+
+ private:
+  uint32_t Random();
+
+  uint32_t rng_state_ = 1;
+  bool is_bassline_ = false;
+};
@@ -0,0 +1,123 @@
+#include "pattern_bank.h"
+
+#include <cstring>
+
+#include "pitch.h"
+
+namespace {
+constexpr uint32_t kMagic = 0x4250534bu;  // "KSPB"
+// Bump when the layout changes; older images then load as an empty bank
+constexpr uint16_t kVersion = 1;
+}  // namespace
+
+void PatternBank::Init() {
+  memset(&image_, 0, sizeof(image_));
+  image_.magic = kMagic;
+  image_.version = kVersion;
+  image_.boot_slot = kEmpty;
+  image_.last_slot = kEmpty;
+}
+
+bool PatternBank::Load(const void* data) {
+  memcpy(&image_, data, sizeof(image_));
+  bool valid = image_.magic == kMagic && image_.version == kVersion && image_.checksum == Checksum(image_);
+  // Indices are used as they are, so check them too
+  valid = valid && (image_.boot_slot == kEmpty || image_.boot_slot < NUM_SLOTS);
+  valid = valid && (image_.last_slot == kEmpty || image_.last_slot < NUM_SLOTS);
+  valid = valid && image_.song_length <= MAX_SONG_LENGTH;
+  for (int i = 0; valid && i < image_.song_length; i++) {
+    valid = image_.song[i] < NUM_SLOTS;
+  }
+  for (int s = 0; valid && s < NUM_SLOTS; s++) {
+    valid = image_.patterns[s].length <= Pattern::MAX_STEPS;
+  }
+  if (!valid) {
+    Init();
+  }
+  return valid;
+}
+
+const uint8_t* PatternBank::Image() {
+  image_.checksum = Checksum(image_);
+  return reinterpret_cast<const uint8_t*>(&image_);
+}
+
+bool PatternBank::Store(int slot, const Pattern& pattern) {
+  if (slot < 0 || slot >= NUM_SLOTS || pattern.length < 1 || pattern.length > Pattern::MAX_STEPS) {
+    return false;
+  }
+  if (Used(slot)) {
+    RemoveFromSong(slot);
+  }
+  PackedPattern& packed = image_.patterns[slot];
+  memset(&packed, 0, sizeof(packed));
+  packed.length = static_cast<uint8_t>(pattern.length);
+  for (int i = 0; i < pattern.length; i++) {
+    const int velocity = static_cast<int>(pattern.velocity[i] * 100.0f + 0.5f);
+    packed.steps[i].note = (pattern.note[i] & ~kRestBit) | (pattern.is_rest[i] ? kRestBit : 0);
+    packed.steps[i].velocity = static_cast<uint8_t>(velocity < 0 ? 0 : (velocity > 100 ? 100 : velocity));
+  }
+  image_.last_slot = static_cast<uint8_t>(slot);
+  return true;
+}
+
+bool PatternBank::Recall(int slot, Pattern& pattern) const {
+  if (!Used(slot)) {
+    return false;
+  }
+  const PackedPattern& packed = image_.patterns[slot];
+  pattern.length = packed.length;
+  for (int i = 0; i < packed.length; i++) {
+    const uint8_t note = packed.steps[i].note & ~kRestBit;
+    pattern.note[i] = note;
+    pattern.freq[i] = MidiToFreq(note);
+    pattern.is_rest[i] = (packed.steps[i].note & kRestBit) != 0;
+    pattern.velocity[i] = packed.steps[i].velocity / 100.0f;
+  }
+  return true;
+}
+
+bool PatternBank::Used(int slot) const { return slot >= 0 && slot < NUM_SLOTS && image_.patterns[slot].length > 0; }
+
+int PatternBank::NextSlot() const {
+  const int start = image_.last_slot == kEmpty ? 0 : (image_.last_slot + 1) % NUM_SLOTS;
+  for (int i = 0; i < NUM_SLOTS; i++) {
+    const int slot = (start + i) % NUM_SLOTS;
+    if (!Used(slot)) {
+      return slot;
+    }
+  }
+  return start;
+}
+
+void PatternBank::SetBootSlot(int slot) {
+  image_.boot_slot = Used(slot) ? static_cast<uint8_t>(slot) : kEmpty;
+}
+
+bool PatternBank::AppendToSong(int slot) {
+  if (!Used(slot) || image_.song_length >= MAX_SONG_LENGTH) {
+    return false;
+  }
+  image_.song[image_.song_length++] = static_cast<uint8_t>(slot);
+  return true;
+}
+
+void PatternBank::RemoveFromSong(int slot) {
+  int kept = 0;
+  for (int i = 0; i < image_.song_length; i++) {
+    if (image_.song[i] != slot) {
+      image_.song[kept++] = image_.song[i];
+    }
+  }
+  image_.song_length = static_cast<uint8_t>(kept);
+}
+
+uint32_t PatternBank::Checksum(const BankImage& image) {
+  // FNV-1a over everything before the checksum itself
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&image);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(BankImage, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
@@ -0,0 +1,100 @@
+// Saved patterns, and the song they chain into.
+//
+// The bank is a fixed-size binary image, NUM_SLOTS packed patterns plus a
+// header, written to flash as is and read straight back from it. A packed
+// step is two bytes: the MIDI note with the rest flag in its top bit, and
+// the velocity in percent, which is the generator's own resolution. Recall()
+// unpacks a slot into a Pattern, frequencies and all, so playing it back
+// costs the engine nothing more than a generated one.
+//
+// The image carries a magic number, a format version and a checksum. Load()
+// rejects anything else, such as erased or never written flash, and the
+// bank then starts out empty.
+//
+// The song is a list of slots, played one bar each in order and round again.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "pattern.h"
+
+class PatternBank {
+ public:
+  static constexpr int NUM_SLOTS = 64;
+  static constexpr int MAX_SONG_LENGTH = 64;
+  static constexpr int NO_SLOT = -1;
+
+  // Empties every slot and the song
+  void Init();
+
+  // Takes over an image read from flash. Returns false, leaving the bank
+  // empty, if it isn't a valid one.
+  bool Load(const void* data);
+
+  // The image to write to flash, ImageSize() bytes. Valid until the bank
+  // changes.
+  const uint8_t* Image();
+  static constexpr size_t ImageSize();
+
+  // Packs pattern into slot. Returns false for a slot out of range. A slot
+  // that was used is taken out of the song first, so the song never plays
+  // a pattern that wasn't saved into it.
+  bool Store(int slot, const Pattern& pattern);
+  // Unpacks slot into pattern. Returns false if the slot is empty.
+  bool Recall(int slot, Pattern& pattern) const;
+  bool Used(int slot) const;
+  // The first empty slot after the one stored last, wrapping round to
+  // overwrite the oldest when the bank is full (see Store())
+  int NextSlot() const;
+
+  // Slot recalled at power-up, or NO_SLOT
+  int BootSlot() const { return image_.boot_slot == kEmpty ? NO_SLOT : image_.boot_slot; }
+  void SetBootSlot(int slot);
+
+  // Stirred into the pattern generator's seed at power-up, so patterns
+  // composed after a recall differ from the last session's
+  uint32_t Seed() const { return image_.seed; }
+  void SetSeed(uint32_t seed) { image_.seed = seed; }
+
+  int SongLength() const { return image_.song_length; }
+  int SongSlot(int index) const { return image_.song[index]; }
+  // Returns false if the song is full or slot is empty
+  bool AppendToSong(int slot);
+  void ClearSong() { image_.song_length = 0; }
+
+ private:
+  void RemoveFromSong(int slot);
+
+  static constexpr uint8_t kEmpty = 0xff;
+  static constexpr uint8_t kRestBit = 0x80;
+
+  struct PackedStep {
+    uint8_t note;      // MIDI note, kRestBit set for a rest
+    uint8_t velocity;  // Percent
+  };
+
+  struct PackedPattern {
+    uint8_t length;  // 0 for an empty slot
+    uint8_t reserved;
+    PackedStep steps[Pattern::MAX_STEPS];
+  };
+
+  struct BankImage {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t boot_slot;    // kEmpty for none
+    uint8_t last_slot;    // Stored last, kEmpty for none
+    uint32_t seed;
+    uint8_t song_length;
+    uint8_t song[MAX_SONG_LENGTH];
+    uint8_t reserved[3];
+    PackedPattern patterns[NUM_SLOTS];
+    uint32_t checksum;  // Of everything above
+  };
+
+  static uint32_t Checksum(const BankImage& image);
+
+  BankImage image_;
+};
+
+constexpr size_t PatternBank::ImageSize() { return sizeof(BankImage); }
@@ -0,0 +1,82 @@
+// Pitch and frequency math without powf on the audio or step paths.
+//
+// MIDI notes map to Hz through a table the compiler builds, fractional
+// semitones (pitch bend, glide) go through FastExp2(), and the fixed detune
+// intervals used by the second oscillator are plain constants.
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "fast_math.h"
+
+// Bound on FastExp2()'s relative error against exp2, about 0.009 cents. The
+// float sweep in kidsynth_bench measures 3.5e-6 to 4.0e-6 depending on the
+// compiler's rounding; the bound leaves room above that.
+constexpr float kFastExp2MaxRelError = 5.0e-6f;
+
+// 2^x for |x| < 126. Splits off the integer part into the float exponent and
+// evaluates a degree-4 polynomial fitted to 2^f on [0, 1) for the rest.
+inline float FastExp2(float x) {
+  // floor() via truncation, which stays branch-free and vectorizes
+  int32_t whole = static_cast<int32_t>(x);
+  whole -= x < static_cast<float>(whole) ? 1 : 0;
+  float f = x - static_cast<float>(whole);
+  float p = 1.00000349f + f * (0.692972922f + f * (0.241604357f + f * (0.0517449978f + f * 0.0136703095f)));
+  int32_t e = whole + 127;
+  e = e < 1 ? 1 : (e > 254 ? 254 : e);
+  uint32_t bits = static_cast<uint32_t>(e) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+// Frequency ratio of an interval in (fractional) semitones
+inline float SemitonesToRatio(float semitones) {
+  return FastExp2(semitones * (1.0f / 12.0f));
+}
+
+constexpr double kLn2 = 0.69314718055994530942;
+
+struct MidiFreqTable {
+  float hz[128];
+};
+
+constexpr MidiFreqTable MakeMidiFreqTable() {
+  MidiFreqTable table = {};
+  for (int note = 0; note < 128; note++) {
+    table.hz[note] = static_cast<float>(440.0 * ConstExp(kLn2 * (note - 69) / 12.0));
+  }
+  return table;
+}
+
+// Class template so the table is defined once across translation units
+template <typename T = void>
+struct MidiFreqTableHolder {
+  static constexpr MidiFreqTable table = MakeMidiFreqTable();
+};
+
+template <typename T>
+constexpr MidiFreqTable MidiFreqTableHolder<T>::table;
+
+inline float MidiToFreq(int note) {
+  note = note < 0 ? 0 : (note > 127 ? 127 : note);
+  return MidiFreqTableHolder<>::table.hz[note];
+}
+
+inline float MidiToFreq(float note) {
+  float whole = floorf(note);
+  return MidiToFreq(static_cast<int>(whole)) * SemitonesToRatio(note - whole);
+}
+
+// Second oscillator intervals, each with 0.5% detune for subtle beating/chorus
+constexpr float kDetuneRatio = 1.005f;
+constexpr float kFifthUpRatio = 1.5f * kDetuneRatio;            // Perfect fifth up + detune
+constexpr float kFifthDownRatio = (2.0f / 3.0f) / kDetuneRatio;  // Perfect fifth down + detune
+constexpr float kUnisonRatio = kDetuneRatio;                    // Unison + slight detune
+constexpr float kSubOctaveRatio = 0.5f;                         // Sub-bass one octave down
+
+// Picks the second oscillator interval from the joystick detune amount
+inline float DetuneIntervalRatio(float osc_mod_amount) {
+  return osc_mod_amount > 0.0f ? kFifthUpRatio : (osc_mod_amount < 0.0f ? kFifthDownRatio : kUnisonRatio);
+}
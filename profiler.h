@@ -0,0 +1,247 @@
+// Per-stage CPU profiling for the audio callback.
+//
+// ProfileScope times a block pass with the core's cycle counter: DWT CYCCNT
+// on the Seed's Cortex-M7, the time stamp counter (or CLOCK_MONOTONIC where
+// there is none) on the host build. Stage times are summed over a callback,
+// then EndCallback() folds them into min/avg/max figures along with the
+// callback's total time, its load against the real-time budget and a count
+// of overruns.
+//
+// The audio callback is the only writer. Statistics are published under a
+// sequence counter, so the main loop can take a consistent snapshot with
+// Read() at any time without locking or disabling interrupts.
+//
+// Build with -DKIDSYNTH_PROFILE=0 (make PROFILE=0) to compile all of it
+// out; the classes remain but every call is empty.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef KIDSYNTH_PROFILE
+#define KIDSYNTH_PROFILE 1
+#endif
+
+#if KIDSYNTH_PROFILE && defined(KIDSYNTH_HOST)
+#include "cycle_counter.h"
+#endif
+
+enum ProfileStage {
+  PROFILE_CLOCK,
+  PROFILE_MODULATION,
+  PROFILE_VOICES,
+  PROFILE_NONLINEAR,  // Bitcrush and saturation, including any oversampling
+  PROFILE_DELAY,
+  PROFILE_OUTPUT,
+  NUM_PROFILE_STAGES
+};
+
+inline const char* ProfileStageName(int stage) {
+  static const char* const kNames[NUM_PROFILE_STAGES] = {
+    "clock", "modulation", "voices", "nonlinear", "delay", "output",
+  };
+  return stage >= 0 && stage < NUM_PROFILE_STAGES ? kNames[stage] : "?";
+}
+
+// Cycle counts of one stage (or the whole callback) per callback
+struct ProfileTiming {
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+
+  float Average(uint32_t count) const { return count ? static_cast<float>(total) / count : 0.0f; }
+};
+
+struct ProfileStats {
+  uint32_t callbacks;        // Callbacks since the last reset
+  uint32_t overruns;         // Callbacks that took longer than their budget
+  float ticks_per_second;    // Counter rate, to turn ticks into time
+  float load;                // Last callback's time over its budget
+  float average_load;        // Total time over total budget
+  float max_load;
+  ProfileTiming callback;
+  ProfileTiming stages[NUM_PROFILE_STAGES];
+};
+
+#if KIDSYNTH_PROFILE
+
+#if defined(KIDSYNTH_HOST)
+
+inline uint32_t ProfileTicks() {
+#if KIDSYNTH_HAVE_CYCLE_COUNTER
+  return static_cast<uint32_t>(ReadCycles());
+#else
+  return static_cast<uint32_t>(ReadNanoseconds());
+#endif
+}
+
+// The TSC rate isn't known up front, so it is measured once against the
+// monotonic clock
+inline float ProfileTicksPerSecond() {
+#if KIDSYNTH_HAVE_CYCLE_COUNTER
+  static const float rate = [] {
+    const uint64_t ns_start = ReadNanoseconds();
+    const uint64_t cycles_start = ReadCycles();
+    while (ReadNanoseconds() - ns_start < 5000000) {
+    }
+    const uint64_t ns = ReadNanoseconds() - ns_start;
+    return static_cast<float>((ReadCycles() - cycles_start) * 1.0e9 / ns);
+  }();
+  return rate;
+#else
+  return 1.0e9f;
+#endif
+}
+
+inline void ProfileEnableCounter() {}
+
+#else
+
+// Cortex-M7 debug registers (ARMv7-M architecture reference, C1.8)
+namespace profile_regs {
+volatile uint32_t* const kDemcr = reinterpret_cast<volatile uint32_t*>(0xE000EDFC);
+volatile uint32_t* const kDwtCtrl = reinterpret_cast<volatile uint32_t*>(0xE0001000);
+volatile uint32_t* const kDwtCyccnt = reinterpret_cast<volatile uint32_t*>(0xE0001004);
+volatile uint32_t* const kDwtLar = reinterpret_cast<volatile uint32_t*>(0xE0001FB0);
+}  // namespace profile_regs
+
+extern "C" uint32_t SystemCoreClock;
+
+inline uint32_t ProfileTicks() { return *profile_regs::kDwtCyccnt; }
+
+inline float ProfileTicksPerSecond() { return static_cast<float>(SystemCoreClock); }
+
+inline void ProfileEnableCounter() {
+  *profile_regs::kDemcr |= 1u << 24;  // TRCENA
+  *profile_regs::kDwtLar = 0xC5ACCE55;  // Unlock the DWT on the M7
+  *profile_regs::kDwtCyccnt = 0;
+  *profile_regs::kDwtCtrl |= 1u;  // CYCCNTENA
+}
+
+#endif
+
+class Profiler {
+ public:
+  void Init(float sample_rate) {
+    ProfileEnableCounter();
+    ticks_per_second_ = ProfileTicksPerSecond();
+    ticks_per_sample_ = ticks_per_second_ / sample_rate;
+    Clear();
+    seq_.store(0, std::memory_order_relaxed);
+    reset_requested_.store(false, std::memory_order_relaxed);
+  }
+
+  void BeginCallback() {
+    for (int s = 0; s < NUM_PROFILE_STAGES; s++) {
+      current_[s] = 0;
+    }
+    callback_start_ = ProfileTicks();
+  }
+
+  // size samples were rendered since BeginCallback()
+  void EndCallback(size_t size) {
+    const uint32_t elapsed = ProfileTicks() - callback_start_;
+    const float budget = ticks_per_sample_ * size;
+
+    if (reset_requested_.exchange(false, std::memory_order_acquire)) {
+      Clear();
+    }
+    const uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    stats_.callbacks++;
+    stats_.load = elapsed / budget;
+    stats_.overruns += stats_.load > 1.0f ? 1 : 0;
+    stats_.max_load = stats_.load > stats_.max_load ? stats_.load : stats_.max_load;
+    budget_total_ += static_cast<uint64_t>(budget);
+    Accumulate(stats_.callback, elapsed);
+    stats_.average_load = static_cast<float>(stats_.callback.total) / budget_total_;
+    for (int s = 0; s < NUM_PROFILE_STAGES; s++) {
+      Accumulate(stats_.stages[s], current_[s]);
+    }
+
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  void AddStage(int stage, uint32_t ticks) { current_[stage] += ticks; }
+
+  // Time the last callback took over its budget; audio callback only
+  float LastLoad() const { return stats_.load; }
+
+  // Consistent copy of the statistics; safe to call from outside the audio
+  // callback, which is never held up by it
+  void Read(ProfileStats& stats) const {
+    uint32_t before, after;
+    do {
+      before = seq_.load(std::memory_order_acquire);
+      stats = stats_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+
+  // Starts the statistics over from the next callback
+  void Reset() { reset_requested_.store(true, std::memory_order_release); }
+
+ private:
+  static void Accumulate(ProfileTiming& timing, uint32_t ticks) {
+    timing.min = ticks < timing.min ? ticks : timing.min;
+    timing.max = ticks > timing.max ? ticks : timing.max;
+    timing.total += ticks;
+  }
+
+  void Clear() {
+    stats_ = ProfileStats();
+    stats_.ticks_per_second = ticks_per_second_;
+    stats_.callback.min = UINT32_MAX;
+    for (int s = 0; s < NUM_PROFILE_STAGES; s++) {
+      stats_.stages[s].min = UINT32_MAX;
+    }
+    budget_total_ = 0;
+  }
+
+  float ticks_per_second_ = 0.0f;
+  float ticks_per_sample_ = 0.0f;
+  uint64_t budget_total_ = 0;  // Sum of the callbacks' budgets
+  uint32_t callback_start_ = 0;
+  uint32_t current_[NUM_PROFILE_STAGES] = {};
+  ProfileStats stats_ = {};
+  std::atomic<uint32_t> seq_{0};
+  std::atomic<bool> reset_requested_{false};
+};
+
+// Times its own lifetime as part of stage
+class ProfileScope {
+ public:
+  ProfileScope(Profiler& profiler, int stage) : profiler_(profiler), stage_(stage), start_(ProfileTicks()) {}
+  ~ProfileScope() { profiler_.AddStage(stage_, ProfileTicks() - start_); }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+ private:
+  Profiler& profiler_;
+  int stage_;
+  uint32_t start_;
+};
+
+#else  // KIDSYNTH_PROFILE
+
+class Profiler {
+ public:
+  void Init(float) {}
+  void BeginCallback() {}
+  void EndCallback(size_t) {}
+  void AddStage(int, uint32_t) {}
+  float LastLoad() const { return 0.0f; }
+  void Read(ProfileStats& stats) const { stats = ProfileStats(); }
+  void Reset() {}
+};
+
+class ProfileScope {
+ public:
+  ProfileScope(Profiler&, int) {}
+};
+
+#endif  // KIDSYNTH_PROFILE
@@ -0,0 +1,104 @@
+// Fast tanh-style saturation.
+//
+// Three curves, from most to least accurate:
+//
+//   SATURATION_PADE   [7/6] Pade approximant of tanh, clamped where it meets 1
+//   SATURATION_TABLE  compile-time tanh table with linear interpolation
+//   SATURATION_CUBIC  x - 4/27 x^3 soft clip, unity slope at zero
+//
+// SaturationMaxError() is the largest absolute difference from tanhf() for any
+// finite input; host/bench_kernels.cpp sweeps each curve and checks it.
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+#include "fast_math.h"
+
+enum SaturationCurve {
+  SATURATION_PADE,
+  SATURATION_TABLE,
+  SATURATION_CUBIC,
+  NUM_SATURATION_CURVES
+};
+
+constexpr float SaturationMaxError(SaturationCurve curve) {
+  return curve == SATURATION_PADE    ? 1.0e-4f
+         : curve == SATURATION_TABLE ? 1.0e-4f
+                                     : 0.115f;
+}
+
+// Beyond this the approximant overshoots 1; it is within 1e-6 of tanh here
+constexpr float kSaturationPadeClamp = 4.97f;
+
+inline float SaturatePade(float x) {
+  x = FastClamp(x, -kSaturationPadeClamp, kSaturationPadeClamp);
+  float x2 = x * x;
+  float num = x * (135135.0f + x2 * (17325.0f + x2 * (378.0f + x2)));
+  float den = 135135.0f + x2 * (62370.0f + x2 * (3150.0f + x2 * 28.0f));
+  return num / den;
+}
+
+// tanh(|x|) sampled on [0, kSaturationTableRange]; past the end it is 1 to
+// within float precision of the interpolation error
+constexpr int kSaturationTableSize = 256;
+constexpr float kSaturationTableRange = 6.0f;
+
+struct SaturationTable {
+  float value[kSaturationTableSize + 1];
+};
+
+constexpr SaturationTable MakeSaturationTable() {
+  SaturationTable table = {};
+  for (int i = 0; i <= kSaturationTableSize; i++) {
+    table.value[i] = static_cast<float>(ConstTanh(i * double(kSaturationTableRange) / kSaturationTableSize));
+  }
+  return table;
+}
+
+// Class template so the table is defined once across translation units
+template <typename T = void>
+struct SaturationTableHolder {
+  static constexpr SaturationTable table = MakeSaturationTable();
+};
+
+template <typename T>
+constexpr SaturationTable SaturationTableHolder<T>::table;
+
+inline float SaturateTable(float x) {
+  const float scale = kSaturationTableSize / kSaturationTableRange;
+  float pos = FastClamp(fabsf(x) * scale, 0.0f, kSaturationTableSize - 0.0001f);
+  int idx = static_cast<int>(pos);
+  float frac = pos - idx;
+  const float* v = SaturationTableHolder<>::table.value;
+  float y = v[idx] + frac * (v[idx + 1] - v[idx]);
+  return copysignf(y, x);
+}
+
+inline float SaturateCubic(float x) {
+  x = FastClamp(x, -1.5f, 1.5f);
+  return x - (4.0f / 27.0f) * x * x * x;
+}
+
+template <SaturationCurve curve>
+inline float Saturate(float x) {
+  return curve == SATURATION_PADE    ? SaturatePade(x)
+         : curve == SATURATION_TABLE ? SaturateTable(x)
+                                     : SaturateCubic(x);
+}
+
+// out[i] = saturate(in[i] * drive) * gain; in and out may alias
+template <SaturationCurve curve>
+inline void SaturateBlock(const float* in, float* out, size_t size, float drive = 1.0f, float gain = 1.0f) {
+  for (size_t i = 0; i < size; i++) {
+    out[i] = Saturate<curve>(in[i] * drive) * gain;
+  }
+}
+
+inline void SaturateBlock(SaturationCurve curve, const float* in, float* out, size_t size, float drive = 1.0f,
+                          float gain = 1.0f) {
+  switch (curve) {
+    case SATURATION_TABLE: SaturateBlock<SATURATION_TABLE>(in, out, size, drive, gain); break;
+    case SATURATION_CUBIC: SaturateBlock<SATURATION_CUBIC>(in, out, size, drive, gain); break;
+    default: SaturateBlock<SATURATION_PADE>(in, out, size, drive, gain); break;
+  }
+}
@@ -0,0 +1,50 @@
+// Lock-free single-producer, single-consumer queue.
+//
+// One thread (or the main loop) pushes and one other (the audio callback)
+// peeks and pops. Neither side ever blocks or allocates: Push() fails when
+// the queue is full and the producer decides what to do about it.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+ public:
+  static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+  // Producer side. Returns false, leaving the queue untouched, when full.
+  bool Push(const T& item) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= CAPACITY) {
+      return false;
+    }
+    items_[tail & kMask] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side: whether the consumer has taken everything pushed
+  bool Drained() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+  }
+
+  // Consumer side: the oldest item, or nullptr when empty. Valid until Pop().
+  const T* Peek() const {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &items_[head & kMask];
+  }
+
+  // Consumer side: drops the item Peek() returned
+  void Pop() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+ private:
+  static constexpr uint32_t kMask = CAPACITY - 1;
+
+  T items_[CAPACITY];
+  std::atomic<uint32_t> head_{0};  // Next to read, written by the consumer
+  std::atomic<uint32_t> tail_{0};  // Next to write, written by the producer
+};
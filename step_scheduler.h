@@ -0,0 +1,90 @@
+// Sample-accurate step clock for the sequencer.
+//
+// Time is kept as a 64-bit count of samples, and step boundaries in 48.16
+// fixed point, so nothing drifts however long the set runs: each boundary is
+// the previous one plus the step's duration, which is worked out once, when
+// the step starts, from the tempo and swing at that moment. A block then
+// only has to compare against the next boundary.
+//
+// Swing lengthens the even step of each pair and shortens the odd one by the
+// same amount, so a pair always lasts two straight steps.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class StepScheduler {
+ public:
+  // Fixed-point fraction bits of step boundaries
+  static constexpr int FRAC_BITS = 16;
+
+  // Where the sequencer is: steps started and samples run since Init()
+  struct Position {
+    uint64_t sample;
+    uint32_t step_count;  // Steps started, the one playing included
+    uint32_t step;        // Index of the step playing, 0 to num_steps - 1
+  };
+
+  // Starts at step 0 without announcing it; the first event is step 1, one
+  // step length from now
+  void Init(int num_steps) {
+    num_steps_ = num_steps;
+    sample_ = 0;
+    step_count_ = 0;
+    step_ = 0;
+    next_boundary_ = 0;
+    scheduled_ = false;
+  }
+
+  // Timing for the steps that start from now on. step_samples is the length
+  // of a straight step, swing the share of a pair the even step gets (0.5 is
+  // straight).
+  void SetTiming(double step_samples, float swing) {
+    step_samples_ = step_samples;
+    swing_ = swing;
+    // The very first boundary is set once the timing is known
+    if (!scheduled_) {
+      next_boundary_ = Duration(step_);
+      scheduled_ = true;
+    }
+  }
+
+  // If a step starts within the next size samples, returns true with its
+  // offset and makes it the current step. Call until false, then Advance().
+  bool NextStep(size_t size, size_t& offset) {
+    const uint64_t due = (next_boundary_ + kFracMask) >> FRAC_BITS;  // First sample at or after it
+    if (due >= sample_ + size) {
+      return false;
+    }
+    offset = due > sample_ ? static_cast<size_t>(due - sample_) : 0;
+    step_ = (step_ + 1) % num_steps_;
+    step_count_++;
+    next_boundary_ += Duration(step_);
+    return true;
+  }
+
+  // Steps in a bar, from the step after the current one on
+  void SetNumSteps(int num_steps) { num_steps_ = num_steps; }
+
+  // Moves time on by size samples
+  void Advance(size_t size) { sample_ += size; }
+
+  Position GetPosition() const { return {sample_, step_count_, step_}; }
+
+ private:
+  static constexpr uint64_t kFracMask = (1ull << FRAC_BITS) - 1;
+
+  uint64_t Duration(uint32_t step) const {
+    const double share = (step % 2 == 0) ? swing_ : 1.0f - swing_;
+    const double samples = 2.0 * step_samples_ * share;
+    return static_cast<uint64_t>(samples * (1ull << FRAC_BITS) + 0.5);
+  }
+
+  int num_steps_ = 8;
+  uint64_t sample_ = 0;
+  uint64_t next_boundary_ = 0;  // 48.16 fixed point samples
+  uint32_t step_count_ = 0;
+  uint32_t step_ = 0;
+  double step_samples_ = 0.0;
+  float swing_ = 0.5f;
+  bool scheduled_ = false;
+};
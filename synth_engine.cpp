@@ -0,0 +1,637 @@
+#include "synth_engine.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "fast_math.h"
+#include "memory_placement.h"
+#include "pitch.h"
+
+KidSynth::KidSynth() {
+  matrix_.SetRoute(0, {MOD_SRC_LFO1, MOD_DEST_CUTOFF, 500.0f});
+  matrix_.SetRoute(1, {MOD_SRC_LFO1, MOD_DEST_RESONANCE, 0.02f});
+  matrix_.SetRoute(2, {MOD_SRC_LFO1, MOD_DEST_AMP, 0.05f});  // Subtle movement
+  matrix_.SetRoute(3, {MOD_SRC_ENVELOPE, MOD_DEST_CUTOFF, 1000.0f});
+}
+
+void KidSynth::Init(float sample_rate, int16_t* delay_buffer, size_t delay_size) {
+  sample_rate_ = sample_rate;
+
+  // Settings made before Init() take effect straight away
+  while (const ParamEvent* event = param_queue_.Peek()) {
+    ApplyParam(event->id, event->value);
+    param_queue_.Pop();
+  }
+  ApplyRoutes();
+  sample_clock_.store(0, std::memory_order_release);
+
+  // Init voices
+  voices_.Init(sample_rate);
+  for (int v = 0; v < VoicePool::MAX_VOICES; v++) {
+    traced_stage_[v] = VoicePool::ENV_IDLE;
+  }
+
+  // Pitch bend glides with a ~5ms time constant, and stops once it is
+  // inaudibly close
+  bend_smoother_.Init(OnePoleCoeff(0.005f, sample_rate), 0.001f, pitch_bend_target_);
+  osc2_ratio_ = DetuneIntervalRatio(osc_mod_amount_);
+
+  // Init lfos
+  lfo_.Init(sample_rate, lfo_freq_);
+  lfo2_.Init(sample_rate, lfo2_freq_);
+  control_left_ = 0;
+  note_step_ = 0.0f;
+  delay_mod_ = 0.0f;
+  bitcrush_mod_ = 0.0f;
+
+  // Remove DC offset from the output chain, below ~76Hz
+  dc_coeff_ = 1.0f - 2.0f * static_cast<float>(M_PI) * 76.4f / sample_rate;
+  dc_in_ = 0.0f;
+  dc_out_ = 0.0f;
+
+  // Init delay
+  delay_.Init(delay_buffer, delay_size);
+  delay_flushed_ = delay_.Size();
+  tone_lp_ = 0.0f;
+  tone_hp_ = 0.0f;
+  // Repeats lose lows below ~150Hz and highs above ~4kHz on every pass, so
+  // they thin out and darken as they decay instead of building up mud
+  tone_lp_coeff_ = OnePoleLowpassCoeff(4000.0f, sample_rate);
+  tone_hp_coeff_ = OnePoleLowpassCoeff(150.0f, sample_rate);
+  // Gentle low-pass on the output to roll off high-frequency hiss
+  output_lp_coeff_ = OnePoleLowpassCoeff(2725.0f, sample_rate);
+  hp_smooth_ = 0.0f;
+
+  scheduler_.Init(Pattern::DEFAULT_STEPS);
+  // Cutoff glides over ~10ms and tempo over ~20ms. The delay time takes
+  // ~70ms, so the repeats bend in pitch like tape.
+  cutoff_smoother_.Init(OnePoleCoeff(0.0104f, sample_rate), 0.01f, cutoff_target_);
+  bpm_smooth_ = bpm_target_;
+  bpm_glide_rate_ = -1.0f / (0.0208f * sample_rate * static_cast<float>(kLn2));
+  delay_smoother_.Init(OnePoleCoeff(0.0694f, sample_rate), 0.01f, DelayTime());
+  current_step_ = 0;
+  bitcrusher_.Init();
+  bitcrusher_.SetBits(8);  // Slightly higher resolution for a gentler effect
+  // Its own noise, so bitcrush doesn't change the patterns
+  bitcrusher_.Seed(seed_ ^ 0x5bd1e995u);
+  oversampler_.Init();
+  UpdateOversampling(oversampling_);
+  // Toggled effects start as set, then fade over 5ms when switched
+  const float fade_samples = 0.005f * sample_rate;
+  bitcrush_fade_.Init(fade_samples);
+  delay_fade_.Init(fade_samples);
+  half_volume_fade_.Init(fade_samples);
+  profiler_.Init(sample_rate);
+  generator_.Init(seed_);
+
+  // Silent until the first pattern arrives, which then starts at once
+  pattern_.length = Pattern::DEFAULT_STEPS;
+  for (int i = 0; i < MAX_STEPS; i++) {
+    pattern_.note[i] = 0;
+    pattern_.freq[i] = 0.0f;
+    pattern_.is_rest[i] = true;
+    pattern_.velocity[i] = 0.0f;
+  }
+  has_pattern_ = false;
+}
+
+void KidSynth::Seed(uint32_t seed) {
+  seed_ = seed;
+  generator_.Seed(seed);
+  bitcrusher_.Seed(seed ^ 0x5bd1e995u);
+}
+
+// PARAMETER HANDOFF //
+
+void KidSynth::PostParam(ParamId id, float value) {
+  static_assert(NUM_PARAMS <= 32, "a bit per param in unsent_mask_");
+  const uint32_t bit = 1u << id;
+  // The knobs are re-read every millisecond; only changes are sent
+  if (posted_valid_[id] && posted_[id] == value) {
+    unsent_mask_ &= ~bit;
+    return;
+  }
+  // If the queue is full the change is kept, and RetryParams() sends it
+  // once there is room, unless a newer one replaces it first
+  if (param_queue_.Push({control_time_, id, value})) {
+    posted_[id] = value;
+    posted_valid_[id] = true;
+    unsent_mask_ &= ~bit;
+  } else {
+    unsent_[id] = value;
+    unsent_mask_ |= bit;
+  }
+}
+
+void KidSynth::RetryParams() {
+  for (int id = 0; id < NUM_PARAMS && unsent_mask_ != 0; id++) {
+    if (unsent_mask_ & (1u << id)) {
+      PostParam(static_cast<ParamId>(id), unsent_[id]);
+      if (unsent_mask_ & (1u << id)) {
+        return;  // Still full
+      }
+    }
+  }
+}
+
+void KidSynth::ApplyParam(ParamId id, float value) {
+  switch (id) {
+    case PARAM_TEMPO: bpm_target_ = value; break;
+    case PARAM_CUTOFF: cutoff_target_ = value; break;
+    case PARAM_RESONANCE: resonance_ = value; break;
+    case PARAM_SUSTAIN: sustain_fraction_ = value; break;
+    case PARAM_DETUNE_MOD:
+      osc_mod_amount_ = value;
+      osc2_ratio_ = DetuneIntervalRatio(value);
+      break;
+    case PARAM_ATTACK_MOD: attack_mod_amount_ = value; break;
+    case PARAM_PITCH_BEND: pitch_bend_target_ = value; break;
+    case PARAM_SWING: swing_amount_ = value != 0.0f ? 0.6f : 0.5f; break;
+    case PARAM_DELAY: delay_fade_.SetEnabled(value != 0.0f); break;
+    case PARAM_DELAY_DIVISION: delay_division_ = static_cast<DelayDivision>(static_cast<int>(value)); break;
+    case PARAM_DELAY_BYPASS: delay_bypass_ = static_cast<DelayBypass>(static_cast<int>(value)); break;
+    case PARAM_BITCRUSH: bitcrush_fade_.SetEnabled(value != 0.0f); break;
+    case PARAM_HALF_VOLUME: half_volume_fade_.SetEnabled(value != 0.0f); break;
+    case PARAM_WAVEFORM: waveform_mode_ = static_cast<WaveformMode>(static_cast<int>(value)); break;
+    case PARAM_SATURATION_CURVE: saturation_curve_ = static_cast<SaturationCurve>(static_cast<int>(value)); break;
+    case PARAM_VOICE_COUNT: voices_.SetVoiceCount(static_cast<int>(value)); break;
+    case PARAM_OVERSAMPLING: oversampling_ = value >= 4.0f ? 4 : (value >= 2.0f ? 2 : 1); break;
+    default: break;
+  }
+}
+
+void KidSynth::ApplyDueParams() {
+  const uint32_t now = sample_clock_.load(std::memory_order_relaxed);
+  while (const ParamEvent* event = param_queue_.Peek()) {
+    // Wrap-safe "event->time <= now"
+    if (static_cast<int32_t>(event->time - now) > 0) {
+      break;
+    }
+    ApplyParam(event->id, event->value);
+    trace_.Write(now, TRACE_PARAM, event->id, event->value);
+    param_queue_.Pop();
+  }
+}
+
+bool KidSynth::SetModRoute(int slot, ModSource source, ModDestination destination, float amount) {
+  const ModRoute route = {static_cast<uint8_t>(source), static_cast<uint8_t>(destination), amount};
+  return route_queue_.Push({slot, route});
+}
+
+void KidSynth::ApplyRoutes() {
+  while (const RouteEvent* event = route_queue_.Peek()) {
+    matrix_.SetRoute(event->slot, event->route);
+    route_queue_.Pop();
+  }
+}
+
+size_t KidSynth::SamplesToNextParam(size_t limit) const {
+  const ParamEvent* event = param_queue_.Peek();
+  if (!event) {
+    return limit;
+  }
+  const uint32_t wait = event->time - sample_clock_.load(std::memory_order_relaxed);
+  return std::min<size_t>(limit, wait);
+}
+
+// AUDIO FUNCTIONS //
+
+void KidSynth::StartStep(size_t offset) {
+  current_step_ = scheduler_.GetPosition().step;
+
+  // A queued pattern replaces the current one on the downbeat, so the bar
+  // playing is never half old and half new
+  if (current_step_ == 0 || !has_pattern_) {
+    SwapPattern();
+  }
+
+  // Only start a note if step is not a rest. The voice pass starts it from
+  // this sample of the block on, with the un-bent base frequency; pitch bend
+  // is applied on top. A first pattern shorter than the step reached before
+  // it arrived is silent until it wraps.
+  const uint32_t time = sample_clock_.load(std::memory_order_relaxed) + offset;
+  if (current_step_ < pattern_.length && !pattern_.is_rest[current_step_]) {
+    step_events_[num_step_events_].offset = offset;
+    step_events_[num_step_events_].step = current_step_;
+    step_events_[num_step_events_].freq = pattern_.freq[current_step_];
+    step_events_[num_step_events_].velocity = pattern_.velocity[current_step_];
+    num_step_events_++;
+    trace_.Write(time, TRACE_STEP, current_step_, pattern_.freq[current_step_]);
+  } else {
+    trace_.Write(time, TRACE_STEP, current_step_, 0.0f);
+  }
+}
+
+void KidSynth::SwapPattern() {
+  // Only the newest of several queued patterns is played
+  bool swapped = false;
+  while (const Pattern* pattern = pattern_queue_.Peek()) {
+    pattern_ = *pattern;
+    pattern_queue_.Pop();
+    swapped = true;
+  }
+  has_pattern_ = has_pattern_ || swapped;
+  // Its bar length applies from the next step
+  scheduler_.SetNumSteps(pattern_.length);
+}
+
+// CONTROL FUNCTIONS //
+
+void KidSynth::GenerateSequence() {
+  Pattern pattern;
+  generator_.Generate(pattern);
+  QueuePattern(pattern);
+}
+
+bool KidSynth::QueuePattern(const Pattern& pattern) { return pattern_queue_.Push(pattern); }
+
+// BLOCK PASSES //
+//
+// Process() runs the chain as a series of passes over the whole block instead
+// of one sample at a time: the clock goes first and records where steps
+// start, the modulation sources leave per-sample buffers behind, then the
+// voice pool and each effect is a tight loop over the block. UI toggles are
+// read once per block, and pick the version of the effect chain that runs.
+
+KIDSYNTH_ITCM size_t KidSynth::ClockPass(size_t size) {
+  // Tempo glides with a ~20ms time constant, applied once per chunk
+  const float glide = 1.0f - FastExp2(size * bpm_glide_rate_);
+  bpm_smooth_ += glide * (bpm_target_ - bpm_smooth_);
+  step_length_samples_ = sample_rate_ / ((bpm_smooth_ / 60.0f) * steps_per_beat_);
+  sustain_samples_ = sustain_fraction_ * step_length_samples_;
+  // A straight step lasts two step lengths
+  scheduler_.SetTiming(2.0 * step_length_samples_, swing_amount_);
+
+  num_step_events_ = 0;
+  size_t offset;
+  while (scheduler_.NextStep(size, offset)) {
+    StartStep(offset);
+    // End the chunk early rather than drop a step
+    if (num_step_events_ == MAX_STEP_EVENTS) {
+      size = offset + 1;
+      break;
+    }
+  }
+  scheduler_.Advance(size);
+  return size;
+}
+
+KIDSYNTH_ITCM void KidSynth::ModulationPass(size_t size) {
+  // The smoothers run at control rate and are interpolated up; the LFOs are
+  // read by MatrixPass()
+  cutoff_smoother_.SetTarget(cutoff_target_);
+  cutoff_smoother_.Process(cutoff_buf_, size);
+
+  // Pitch bend glides towards the soft pot position. Once it has arrived the
+  // ratio is the same for the whole block and only needs working out once.
+  bend_smoother_.SetTarget(pitch_bend_target_);
+  if (bend_smoother_.Idle()) {
+    std::fill(bend_buf_, bend_buf_ + size, SemitonesToRatio(bend_smoother_.Value()));
+  } else {
+    bend_smoother_.Process(bend_buf_, size);
+    for (size_t i = 0; i < size; i++) {
+      bend_buf_[i] = SemitonesToRatio(bend_buf_[i]);
+    }
+  }
+}
+
+VoicePool::Params KidSynth::VoiceParams(WaveformMode mode, SaturationCurve curve) const {
+  VoicePool::Params params;
+  switch (mode) {
+    case WAVEFORM_SQUARE:
+      params.osc_amp = 0.035f;
+      params.osc2_amp = 0.056f;
+      params.wave = Wavetable::WAVE_SQUARE;
+      break;
+    case WAVEFORM_SAW_SUB:
+      params.osc_amp = 0.04f;
+      params.osc2_amp = 0.06f;
+      params.wave = Wavetable::WAVE_SAW;
+      break;
+    default:
+      params.osc_amp = 0.05f;
+      params.osc2_amp = 0.08f;
+      params.wave = Wavetable::WAVE_SAW;
+      break;
+  }
+  params.osc2_ratio = osc2_ratio_;
+  // Detune osc level, with dry level compensation to prevent clipping
+  const float detune_amount = fabs(osc_mod_amount_);
+  params.dry_gain = 1.0f - detune_amount * 0.3f;
+  params.detune_gain = detune_amount * 0.7f;
+  params.sub = mode == WAVEFORM_SAW_SUB;
+  params.resonance = resonance_;
+
+  // Joystick positive lengthens the attack from 0.01s up to 0.15s, negative
+  // the release from 0.08s up to 0.5s
+  float attack_modulated = attack_time_;
+  if (attack_mod_amount_ > 0.0f) {
+    attack_modulated = fminf(attack_time_ + (attack_mod_amount_ * 0.14f), 0.15f);
+  }
+  float release_modulated = release_time_;
+  if (attack_mod_amount_ < 0.0f) {
+    release_modulated = fminf(release_time_ + (fabs(attack_mod_amount_) * 0.42f), 0.5f);
+  }
+  params.attack_inc = 1.0f / (attack_modulated * sample_rate_);
+  params.release_dec = 1.0f / (release_modulated * sample_rate_);
+  params.sustain_samples = sustain_samples_;
+  params.curve = curve;
+  return params;
+}
+
+KIDSYNTH_ITCM void KidSynth::VoicePass(float* out, size_t size, WaveformMode mode, SaturationCurve curve) {
+  const VoicePool::Params params = VoiceParams(mode, curve);
+
+  // Render up to each step boundary or control point, whichever is next.
+  // Notes start first, so the matrix sees them at the same sample.
+  size_t start = 0;
+  int e = 0;
+  while (true) {
+    for (; e < num_step_events_ && step_events_[e].offset <= start; e++) {
+      voices_.NoteOn(step_events_[e].freq, step_events_[e].velocity);
+      note_step_ = pattern_.length > 1 ? step_events_[e].step / (pattern_.length - 1.0f) : 0.0f;
+    }
+    if (start == size) {
+      break;
+    }
+    if (control_left_ == 0) {
+      MatrixPass(start);
+      control_left_ = CONTROL_INTERVAL;
+    }
+    size_t end = std::min(size, start + control_left_);
+    if (e < num_step_events_) {
+      end = std::min(end, step_events_[e].offset);
+    }
+    voices_.Render(params, bend_buf_ + start, cutoff_buf_ + start, out + start, end - start);
+    control_left_ -= end - start;
+    start = end;
+  }
+}
+
+KIDSYNTH_ITCM void KidSynth::MatrixPass(size_t offset) {
+#if KIDSYNTH_TRACE
+  const uint32_t time = sample_clock_.load(std::memory_order_relaxed) + offset;
+  for (int v = 0; v < VoicePool::MAX_VOICES; v++) {
+    const int stage = voices_.Stage(v);
+    if (stage != traced_stage_[v]) {
+      traced_stage_[v] = stage;
+      trace_.Write(time, TRACE_ENVELOPE, v, static_cast<float>(stage));
+    }
+  }
+#endif
+
+  matrix_.SetSource(MOD_SRC_LFO1, lfo_.Next());
+  matrix_.SetSource(MOD_SRC_LFO2, lfo2_.Next());
+  matrix_.SetSource(MOD_SRC_ENVELOPE, voices_.Envelopes());
+  matrix_.SetSource(MOD_SRC_VELOCITY, voices_.Velocities());
+  matrix_.SetSource(MOD_SRC_STEP, note_step_);
+  matrix_.SetSource(MOD_SRC_JOYSTICK_X, osc_mod_amount_);
+  matrix_.SetSource(MOD_SRC_JOYSTICK_Y, attack_mod_amount_);
+  matrix_.SetSource(MOD_SRC_SOFTPOT, pitch_bend_target_ * (1.0f / 24.0f));
+  matrix_.Evaluate();
+
+  // The voices ramp to these over the next control interval
+  float targets[VoicePool::NUM_VOICE_MODS][VoicePool::MAX_VOICES];
+  const float* pitch = matrix_.Output(MOD_DEST_PITCH);
+  const float* cutoff = matrix_.Output(MOD_DEST_CUTOFF);
+  const float* resonance = matrix_.Output(MOD_DEST_RESONANCE);
+  const float* amp = matrix_.Output(MOD_DEST_AMP);
+  const float* drive = matrix_.Output(MOD_DEST_DRIVE);
+  for (int v = 0; v < VoicePool::MAX_VOICES; v++) {
+    targets[VoicePool::MOD_PITCH][v] = SemitonesToRatio(pitch[v]);
+    targets[VoicePool::MOD_CUTOFF][v] = cutoff[v];
+    targets[VoicePool::MOD_RESONANCE][v] = resonance[v];
+    targets[VoicePool::MOD_AMP][v] = std::max(1.0f + amp[v], 0.0f);
+    targets[VoicePool::MOD_DRIVE][v] = std::max(1.0f + drive[v], 0.0f);
+  }
+  voices_.SetModTargets(targets, CONTROL_INTERVAL);
+
+  // The effects aren't per voice; they follow the latest note
+  const int newest = voices_.NewestVoice();
+  delay_mod_ = matrix_.Output(MOD_DEST_DELAY_TIME)[newest];
+  bitcrush_mod_ = matrix_.Output(MOD_DEST_BITCRUSH_RATE)[newest];
+}
+
+void KidSynth::UpdateOversampling(int factor) {
+  oversampler_.SetFactor(factor);
+  // Keep the bitcrush low-pass at the same cutoff at the higher rate
+  bitcrusher_.SetLowpass(OnePoleLowpassCoeff(1704.0f, sample_rate_ * oversampler_.Factor()));
+}
+
+KIDSYNTH_ITCM void KidSynth::EffectsPass(float* buf, size_t size, EffectState bitcrush, EffectState delay,
+                                         SaturationCurve curve) {
+  using Chain = void (KidSynth::*)(float*, size_t, SaturationCurve);
+  static constexpr Chain kChains[NUM_EFFECT_STATES][NUM_EFFECT_STATES] = {
+    {&KidSynth::EffectChain<EFFECT_OFF, EFFECT_OFF>, &KidSynth::EffectChain<EFFECT_OFF, EFFECT_ON>,
+     &KidSynth::EffectChain<EFFECT_OFF, EFFECT_FADING>},
+    {&KidSynth::EffectChain<EFFECT_ON, EFFECT_OFF>, &KidSynth::EffectChain<EFFECT_ON, EFFECT_ON>,
+     &KidSynth::EffectChain<EFFECT_ON, EFFECT_FADING>},
+    {&KidSynth::EffectChain<EFFECT_FADING, EFFECT_OFF>, &KidSynth::EffectChain<EFFECT_FADING, EFFECT_ON>,
+     &KidSynth::EffectChain<EFFECT_FADING, EFFECT_FADING>},
+  };
+  (this->*kChains[bitcrush][delay])(buf, size, curve);
+}
+
+template <EffectState bitcrush, EffectState delay>
+KIDSYNTH_ITCM void KidSynth::EffectChain(float* buf, size_t size, SaturationCurve curve) {
+  {
+    ProfileScope scope(profiler_, PROFILE_NONLINEAR);
+    NonlinearPass<bitcrush>(buf, size, curve);
+  }
+  if (delay == EFFECT_OFF) {
+    FlushDelay(size);
+  } else {
+    ProfileScope scope(profiler_, PROFILE_DELAY);
+    DelayPass<delay>(buf, size);
+  }
+  {
+    ProfileScope scope(profiler_, PROFILE_OUTPUT);
+    OutputPass(buf, size);
+  }
+}
+
+template <EffectState bitcrush>
+KIDSYNTH_ITCM void KidSynth::NonlinearPass(float* buf, size_t size, SaturationCurve curve) {
+  const int factor = oversampler_.Factor();
+  if (factor == 1) {
+    BitcrushPass<bitcrush>(buf, size, 1);
+    SaturationPass(buf, size, curve);
+    return;
+  }
+
+  // Run the nonlinear stages at the higher rate so the harmonics they add
+  // above the base Nyquist are filtered out instead of folding back
+  oversampler_.Upsample(buf, oversampled_buf_, size);
+  BitcrushPass<bitcrush>(oversampled_buf_, size * factor, factor);
+  SaturationPass(oversampled_buf_, size * factor, curve);
+  oversampler_.Downsample(oversampled_buf_, buf, size);
+}
+
+template <EffectState bitcrush>
+KIDSYNTH_ITCM void KidSynth::BitcrushPass(float* buf, size_t size, int factor) {
+  if (bitcrush == EFFECT_OFF) {
+    return;
+  }
+  // Hold for 1/128 of a step, kept between 1/24000s and 1/6000s for a
+  // less aggressive crush
+  const float step_seconds = step_length_samples_ / sample_rate_;
+  const float hold = FastClamp(step_seconds / 128.0f, 1.0f / 24000.0f, 1.0f / 6000.0f);
+  // Modulation speeds the hold rate up or slows it down
+  const float rate = std::max(1.0f + bitcrush_mod_, 0.125f);
+  const float samples = std::max(hold / rate * sample_rate_, 1.0f);
+  bitcrusher_.SetHold(samples * factor);  // Same hold time when oversampled
+  if (bitcrush == EFFECT_ON) {
+    bitcrusher_.Process(buf, size);
+    return;
+  }
+
+  // Fading: crush a copy and crossfade to it from the clean signal
+  std::copy(buf, buf + size, crushed_buf_);
+  bitcrusher_.Process(crushed_buf_, size);
+  float gain = bitcrush_fade_.Start();
+  const float gain_inc = (bitcrush_fade_.End() - gain) / size;
+  for (size_t i = 0; i < size; i++) {
+    gain += gain_inc;
+    buf[i] += gain * (crushed_buf_[i] - buf[i]);
+  }
+}
+
+KIDSYNTH_ITCM void KidSynth::SaturationPass(float* buf, size_t size, SaturationCurve curve) {
+  // Saturation on the voice mix for warmth and character, then filter drive
+  const float filter_drive = 0.65f;  // Increased output level
+  SaturateBlock(curve, buf, buf, size, 1.2f, 0.9f * filter_drive);  // Gentle saturation
+}
+
+float KidSynth::DelayTime() const {
+  // A step is an eighth note; from the smoothed tempo so the delay follows
+  // tempo changes as smoothly as the sequencer does
+  const float step = sample_rate_ * 60.0f / (bpm_smooth_ * steps_per_beat_);
+  float time = step;
+  if (delay_division_ == DELAY_DOTTED_EIGHTH) {
+    time = step * 1.5f;
+  } else if (delay_division_ == DELAY_TRIPLET_EIGHTH) {
+    time = step * (2.0f / 3.0f);
+  }
+  time *= 1.0f + delay_mod_;
+  return FastClamp(time, 1.0f, delay_.Size() - 2.0f);
+}
+
+template <EffectState delay>
+KIDSYNTH_ITCM void KidSynth::DelayPass(float* buf, size_t size) {
+  // Add delay after envelope so repeats can ring out independently
+  const float delay_feedback = 0.30f;  // More repeats for richer delay
+  // Glide to a new delay time; the repeats bend in pitch like tape
+  float delay_time[MAX_BLOCK_SIZE];
+  delay_smoother_.SetTarget(DelayTime());
+  delay_smoother_.Process(delay_time, size);
+  // Fading in or out scales the wet mix, and the dry level with it
+  float mix = mix_ * delay_fade_.Start();
+  const float mix_inc = (mix_ * delay_fade_.End() - mix) / size;
+  for (size_t i = 0; i < size; i++) {
+    float delayed = delay_.Read(delay_time[i]);
+
+    // Band-limit the repeats: low-pass, then take off the lows
+    tone_lp_ += tone_lp_coeff_ * (delayed - tone_lp_);
+    tone_hp_ += tone_hp_coeff_ * (tone_lp_ - tone_hp_);
+    delayed = tone_lp_ - tone_hp_;
+
+    // Write envelope-shaped signal to delay for natural decay
+    delay_.Write(buf[i] + (delayed * delay_feedback));
+    if (delay == EFFECT_FADING) {
+      mix += mix_inc;
+    }
+    buf[i] = buf[i] * (1-mix) + (delayed * mix);
+  }
+  // The line itself decays to exact zeros, but these would otherwise ring
+  // down into denormals
+  tone_lp_ = fabsf(tone_lp_) < 1.0e-20f ? 0.0f : tone_lp_;
+  tone_hp_ = fabsf(tone_hp_) < 1.0e-20f ? 0.0f : tone_hp_;
+  delay_flushed_ = 0;
+}
+
+void KidSynth::FlushDelay(size_t size) {
+  // The repeats start at the right time when the delay comes back
+  delay_smoother_.Reset(DelayTime());
+  if (delay_bypass_ != DELAY_BYPASS_FLUSH || delay_flushed_ == delay_.Size()) {
+    return;
+  }
+  // A little at a time, newest audio first, so no one block pays for the
+  // whole line. The usual delay times are clear within ~5ms.
+  const size_t count = std::min(size * DELAY_FLUSH_RATE, delay_.Size() - delay_flushed_);
+  delay_.Clear(delay_flushed_, count);
+  delay_flushed_ += count;
+  tone_lp_ = 0.0f;
+  tone_hp_ = 0.0f;
+}
+
+KIDSYNTH_ITCM void KidSynth::OutputPass(float* buf, size_t size) {
+  const float lp_coeff = output_lp_coeff_;
+  const float dc_coeff = dc_coeff_;
+  // Master volume toggle (50% when enabled), faded across the block
+  float master_gain = 1.0f - 0.5f * half_volume_fade_.Start();
+  const float gain_inc = (1.0f - 0.5f * half_volume_fade_.End() - master_gain) / size;
+  for (size_t i = 0; i < size; i++) {
+    float out_sig = buf[i] - dc_in_ + dc_coeff * dc_out_;
+    dc_in_ = buf[i];
+    dc_out_ = out_sig;
+
+    // Gentle one-pole low-pass to roll off high-frequency hiss (~2.7kHz)
+    hp_smooth_ += lp_coeff * (out_sig - hp_smooth_);
+
+    master_gain += gain_inc;
+    buf[i] = hp_smooth_ * master_gain;
+  }
+  // Both ring down into denormals in silence
+  dc_out_ = fabsf(dc_out_) < 1.0e-20f ? 0.0f : dc_out_;
+  hp_smooth_ = fabsf(hp_smooth_) < 1.0e-20f ? 0.0f : hp_smooth_;
+}
+
+KIDSYNTH_ITCM void KidSynth::Process(float* out, size_t size) {
+  profiler_.BeginCallback();
+  const size_t total = size;
+  while (size > 0) {
+    // Control changes land on their own sample: apply the ones due now and
+    // end this chunk where the next one is due
+    ApplyDueParams();
+    ApplyRoutes();
+    size_t n;
+    {
+      ProfileScope scope(profiler_, PROFILE_CLOCK);
+      n = ClockPass(SamplesToNextParam(std::min(size, MAX_BLOCK_SIZE)));
+    }
+
+    // Controls only change between chunks, so these hold for this one
+    const WaveformMode mode = waveform_mode_;
+    const SaturationCurve curve = saturation_curve_;
+    const EffectState bitcrush = bitcrush_fade_.Advance(n);
+    const EffectState delay = delay_fade_.Advance(n);
+    half_volume_fade_.Advance(n);
+    if (oversampling_ != oversampler_.Factor()) {
+      UpdateOversampling(oversampling_);
+    }
+
+    {
+      ProfileScope scope(profiler_, PROFILE_MODULATION);
+      ModulationPass(n);
+    }
+    {
+      ProfileScope scope(profiler_, PROFILE_VOICES);
+      VoicePass(out, n, mode, curve);
+    }
+    EffectsPass(out, n, bitcrush, delay, curve);
+
+    out += n;
+    size -= n;
+    sample_clock_.store(sample_clock_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  }
+  profiler_.EndCallback(total);
+  const float load = profiler_.LastLoad();
+  if (load > 1.0f) {
+    trace_.Write(sample_clock_.load(std::memory_order_relaxed), TRACE_OVERRUN, 0, load);
+  }
+}
+
+// The passes host/bench_kernels.cpp times on their own
+template void KidSynth::BitcrushPass<EFFECT_ON>(float* buf, size_t size, int factor);
+template void KidSynth::NonlinearPass<EFFECT_ON>(float* buf, size_t size, SaturationCurve curve);
+template void KidSynth::DelayPass<EFFECT_ON>(float* buf, size_t size);
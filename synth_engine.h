@@ -0,0 +1,350 @@
+// KidSynth sound engine.
+//
+// Everything that makes sound lives in this object: the sequencer clock and
+// pattern, the voice pool (oscillators, envelopes, filters) and effects. The
+// hardware layer in KidSynth.cpp owns a single instance and feeds it from the
+// knobs and buttons; the host tools create as many as they like.
+//
+// Control setters may be called from another thread (the main loop) while
+// Process() runs. They don't touch the sound state: each change is queued
+// with a sample timestamp and Process() applies it at that sample, see
+// SetControlTime().
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_config.h"
+#include "bitcrusher.h"
+#include "compact_delay.h"
+#include "control_rate.h"
+#include "effect_fade.h"
+#include "mod_matrix.h"
+#include "oversampler.h"
+#include "pattern.h"
+#include "profiler.h"
+#include "saturation.h"
+#include "spsc_queue.h"
+#include "step_scheduler.h"
+#include "trace.h"
+#include "voice_pool.h"
+
+class KidSynth {
+ public:
+  static constexpr int MAX_STEPS = Pattern::MAX_STEPS;
+  // Longest delay the controls reach: a dotted eighth at the tempo knob's
+  // slowest, 80bpm, doubled by full delay-time modulation. Longer settings
+  // are clamped to the line.
+  static constexpr float MAX_DELAY_SECONDS = 1.125f;
+  // Delay memory to give Init(): MAX_DELAY_SECONDS at the highest rate,
+  // plus the interpolating read's two samples; 211KB of 16-bit samples
+  static constexpr size_t DELAY_BUFFER_SIZE = static_cast<size_t>(MAX_DELAY_SECONDS * kMaxSampleRate) + 2;
+  // Longer buffers are processed in chunks of this size
+  static constexpr size_t MAX_BLOCK_SIZE = VoicePool::MAX_BLOCK_SIZE;
+  // Step boundaries tracked per chunk; a chunk ends early if it fills up
+  static constexpr int MAX_STEP_EVENTS = 4;
+  // Control changes that can be pending between two Process() calls
+  static constexpr size_t PARAM_QUEUE_SIZE = 64;
+  // Modulation route changes that can be pending
+  static constexpr size_t ROUTE_QUEUE_SIZE = 8;
+  // Trace records Process() can leave before they are read
+  static constexpr size_t TRACE_BUFFER_SIZE = 256;
+  // Delay line cleared per sample rendered while the delay is off, see
+  // DELAY_BYPASS_FLUSH
+  static constexpr size_t DELAY_FLUSH_RATE = 64;
+
+  enum WaveformMode {
+    WAVEFORM_SAW,      // Pure saw wave
+    WAVEFORM_SQUARE,   // Pure square wave
+    WAVEFORM_SAW_SUB,  // Saw with sub-bass for fat low end
+    NUM_WAVEFORM_MODES
+  };
+
+  // Delay time, locked to the sequencer's step (an eighth note)
+  enum DelayDivision {
+    DELAY_EIGHTH,
+    DELAY_DOTTED_EIGHTH,
+    DELAY_TRIPLET_EIGHTH,
+    NUM_DELAY_DIVISIONS
+  };
+
+  // What happens to the delay line while the delay is off
+  enum DelayBypass {
+    DELAY_BYPASS_FLUSH,   // Cleared, so it starts again from silence
+    DELAY_BYPASS_FREEZE,  // Kept, so the old repeats carry on when it's back
+    NUM_DELAY_BYPASS_MODES
+  };
+
+  // Starts with the modulation routing the synth has always had: the slow
+  // LFO on cutoff, resonance and level, and the envelope on cutoff
+  KidSynth();
+
+  // Resets all sound state (control settings are kept), so an instance can
+  // be reused for a fresh render. sample_rate is one of the rates
+  // audio_config.h supports; the sound is the same at each. The delay runs
+  // in delay_size samples of delay_buffer (DELAY_BUFFER_SIZE for the full
+  // range), which must outlive the engine; on the Seed it belongs in SDRAM.
+  void Init(float sample_rate, int16_t* delay_buffer, size_t delay_size);
+
+  // Render size mono samples
+  void Process(float* out, size_t size);
+
+  // Seeds the pattern generator and, separately, the bitcrush dither
+  void Seed(uint32_t seed);
+  // Composes a new pattern and queues it, see QueuePattern()
+  void GenerateSequence();
+  // Hands over a pattern to play from the next bar, or from the next step
+  // if none has played since Init(). If several are queued by then, the
+  // newest wins. Returns false if the queue is full. Safe to call while
+  // Process() runs on another thread.
+  bool QueuePattern(const Pattern& pattern);
+  // Whether a queued pattern has yet to start; false once the last one
+  // queued is playing. Control thread only.
+  bool PatternPending() const { return !pattern_queue_.Drained(); }
+
+  // Sample time, on the SampleClock() scale, that control changes made from
+  // now on take effect at. Changes stamped in the past apply at the start of
+  // the next Process() call; stamp them a block ahead of the clock to keep
+  // their spacing exact. Control thread only.
+  void SetControlTime(uint32_t sample_time) { control_time_ = sample_time; }
+  // Sends changes again that a full queue turned away. The controls only
+  // call the setters when something moves, so call this every control tick.
+  // Control thread only.
+  void RetryParams();
+  // Samples rendered since Init(); safe to read from any thread
+  uint32_t SampleClock() const { return sample_clock_.load(std::memory_order_acquire); }
+
+  // Controls
+  void SetTempo(float bpm) { PostParam(PARAM_TEMPO, bpm); }
+  void SetCutoff(float cutoff_hz) { PostParam(PARAM_CUTOFF, cutoff_hz); }
+  void SetResonance(float resonance) { PostParam(PARAM_RESONANCE, resonance); }
+  // Sustain as a fraction of the current step length
+  void SetSustain(float fraction) { PostParam(PARAM_SUSTAIN, fraction); }
+  // Detune amount from the joystick, -1 (fifth down) to 1 (fifth up)
+  void SetDetuneMod(float amount) { PostParam(PARAM_DETUNE_MOD, amount); }
+  // Joystick attack (positive) / release (negative) lengthening, -1 to 1
+  void SetAttackMod(float amount) { PostParam(PARAM_ATTACK_MOD, amount); }
+  // Pitch bend in semitones; the playing note glides there at audio rate
+  void SetPitchBend(float semitones) { PostParam(PARAM_PITCH_BEND, semitones); }
+  void SetSwing(bool enabled) { PostParam(PARAM_SWING, enabled); }
+  // Effects switched on or off fade in or out over 5ms
+  void SetDelayEnabled(bool enabled) { PostParam(PARAM_DELAY, enabled); }
+  void SetDelayBypass(DelayBypass mode) { PostParam(PARAM_DELAY_BYPASS, mode); }
+  // Repeats glide to the new time when the tempo or division changes
+  void SetDelayDivision(DelayDivision division) { PostParam(PARAM_DELAY_DIVISION, division); }
+  void SetBitcrushEnabled(bool enabled) { PostParam(PARAM_BITCRUSH, enabled); }
+  // Master volume toggle (50% when enabled)
+  void SetHalfVolume(bool enabled) { PostParam(PARAM_HALF_VOLUME, enabled); }
+  void SetWaveformMode(WaveformMode mode) { PostParam(PARAM_WAVEFORM, mode); }
+  // Curve used for the oscillator drive and output saturation
+  void SetSaturationCurve(SaturationCurve curve) { PostParam(PARAM_SATURATION_CURVE, curve); }
+  // Voices steps are spread over so release tails can overlap, 1 (mono) to
+  // VoicePool::MAX_VOICES
+  void SetVoiceCount(int count) { PostParam(PARAM_VOICE_COUNT, count); }
+  // Oversampling around the bitcrush and saturation: 1 (off), 2 or 4
+  void SetOversampling(int factor) { PostParam(PARAM_OVERSAMPLING, factor); }
+  // Replaces modulation route slot (0 to ModMatrix::MAX_ROUTES - 1) from the
+  // next Process() call on; MOD_SRC_NONE clears it. Returns false if too
+  // many changes are already pending. Safe to call while Process() runs.
+  bool SetModRoute(int slot, ModSource source, ModDestination destination, float amount);
+
+  float SampleRate() const { return sample_rate_; }
+  float StepLengthSamples() const { return step_length_samples_; }
+  int CurrentStep() const { return current_step_; }
+  // Samples and steps since Init(), for syncing other sequencers to this one.
+  // Only consistent between Process() calls.
+  StepScheduler::Position SongPosition() const { return scheduler_.GetPosition(); }
+  int ActiveVoices() const { return voices_.ActiveVoices(); }
+  // Per-pass CPU time and load of Process() calls; see profiler.h
+  void ReadProfile(ProfileStats& stats) const { profiler_.Read(stats); }
+  void ResetProfile() { profiler_.Reset(); }
+  // Process() traces steps, envelope stages, control changes and overruns,
+  // see trace.h. Envelope stages are seen once per control interval.
+  // Overruns need the profiler. One reader thread only.
+  bool ReadTrace(TraceRecord& record) { return trace_.Read(record); }
+  uint32_t TakeTraceDropped() { return trace_.TakeDropped(); }
+
+ private:
+  // host/bench_kernels.cpp times the passes and kernels below in isolation
+  friend struct KernelBench;
+
+  enum ParamId {
+    PARAM_TEMPO,
+    PARAM_CUTOFF,
+    PARAM_RESONANCE,
+    PARAM_SUSTAIN,
+    PARAM_DETUNE_MOD,
+    PARAM_ATTACK_MOD,
+    PARAM_PITCH_BEND,
+    PARAM_SWING,
+    PARAM_DELAY,
+    PARAM_DELAY_DIVISION,
+    PARAM_DELAY_BYPASS,
+    PARAM_BITCRUSH,
+    PARAM_HALF_VOLUME,
+    PARAM_WAVEFORM,
+    PARAM_SATURATION_CURVE,
+    PARAM_VOICE_COUNT,
+    PARAM_OVERSAMPLING,
+    NUM_PARAMS
+  };
+
+  // A control change, due at sample time on the SampleClock() scale
+  struct ParamEvent {
+    uint32_t time;
+    ParamId id;
+    float value;
+  };
+
+  // A step that starts a note at a sample offset in the block
+  struct StepEvent {
+    size_t offset;
+    int step;
+    float freq;
+    float velocity;
+  };
+
+  struct RouteEvent {
+    int slot;
+    ModRoute route;
+  };
+
+  // Block passes, in the order Process() runs them
+  size_t ClockPass(size_t size);
+  void ModulationPass(size_t size);
+  void VoicePass(float* out, size_t size, WaveformMode mode, SaturationCurve curve);
+  void MatrixPass(size_t offset);
+  VoicePool::Params VoiceParams(WaveformMode mode, SaturationCurve curve) const;
+  // Runs the version of the effect chain built for the toggled effects'
+  // states in this block
+  void EffectsPass(float* buf, size_t size, EffectState bitcrush, EffectState delay, SaturationCurve curve);
+  template <EffectState bitcrush, EffectState delay>
+  void EffectChain(float* buf, size_t size, SaturationCurve curve);
+  template <EffectState bitcrush>
+  void NonlinearPass(float* buf, size_t size, SaturationCurve curve);
+  template <EffectState bitcrush>
+  void BitcrushPass(float* buf, size_t size, int factor);
+  void SaturationPass(float* buf, size_t size, SaturationCurve curve);
+  template <EffectState delay>
+  void DelayPass(float* buf, size_t size);
+  void FlushDelay(size_t size);
+  float DelayTime() const;
+  void OutputPass(float* buf, size_t size);
+
+  // Control thread side: queues a change unless it repeats the last one
+  void PostParam(ParamId id, float value);
+  // Audio side
+  void ApplyParam(ParamId id, float value);
+  void ApplyDueParams();
+  void ApplyRoutes();
+  size_t SamplesToNextParam(size_t limit) const;
+
+  void StartStep(size_t offset);
+  void SwapPattern();
+  void UpdateOversampling(int factor);
+
+  float sample_rate_ = 48000.0f;
+  uint32_t seed_ = 1;  // From Seed()
+
+  // Control changes in flight from the control thread to Process()
+  SpscQueue<ParamEvent, PARAM_QUEUE_SIZE> param_queue_;
+  std::atomic<uint32_t> sample_clock_{0};
+  uint32_t control_time_ = 0;       // Control thread only
+  float posted_[NUM_PARAMS];        // Control thread only: last value queued
+  bool posted_valid_[NUM_PARAMS] = {};
+  float unsent_[NUM_PARAMS];        // Control thread only: turned away by a full queue
+  uint32_t unsent_mask_ = 0;        // A bit per param with an unsent_ value
+
+  VoicePool voices_;
+  ControlLfo lfo_;
+  ControlLfo lfo2_;
+  CompactDelay delay_;
+
+  float resonance_ = 0.1f;
+  float osc_mod_amount_ = 0.0f;
+  float attack_mod_amount_ = 0.0f;  // Attack time modulation from joystick
+  float cutoff_target_ = 1000.0f;
+  ControlSmoother cutoff_smoother_;
+
+  // Pitch bend from soft pot gesture, in semitones, +/- 24 (2 octaves)
+  float pitch_bend_target_ = 0.0f;
+  ControlSmoother bend_smoother_;
+  float osc2_ratio_ = 1.005f;      // Second oscillator interval for the detune setting
+
+  // Envelope parameters
+  // Attack/Release are hardcoded, sustain is always at 1
+  // You can adjust sustain time to fill the rest of the step.
+  float attack_time_ = 0.01f;   // Shorter for punchier notes
+  float release_time_ = 0.08f;  // Slightly longer for smoother tail
+  float step_length_samples_ = 0.0f;
+  float sustain_fraction_ = 0.5f;
+  float sustain_samples_ = 0.0f;
+
+  Bitcrusher bitcrusher_;
+
+  Oversampler oversampler_;
+  int oversampling_ = 2;
+
+  Profiler profiler_;
+  TraceBuffer<TRACE_BUFFER_SIZE> trace_;
+  int traced_stage_[VoicePool::MAX_VOICES];  // Envelope stages last traced
+
+  // Toggled effects; half volume fades the master gain
+  EffectFade bitcrush_fade_;
+  EffectFade delay_fade_;
+  EffectFade half_volume_fade_;
+  WaveformMode waveform_mode_ = WAVEFORM_SAW;
+  SaturationCurve saturation_curve_ = SATURATION_PADE;
+  float swing_amount_ = 0.5f;
+
+  // Delay state
+  DelayDivision delay_division_ = DELAY_DOTTED_EIGHTH;
+  DelayBypass delay_bypass_ = DELAY_BYPASS_FLUSH;
+  size_t delay_flushed_ = 0;  // Line cleared since the delay went off
+  ControlSmoother delay_smoother_;  // Delay time in samples, gliding
+  float mix_ = 0.42f;  // Balanced wet mix for presence without muddiness
+  float tone_lp_ = 0.0f;  // Feedback tone filter
+  float tone_hp_ = 0.0f;
+  float tone_lp_coeff_ = 0.0f;
+  float tone_hp_coeff_ = 0.0f;
+  float hp_smooth_ = 0.0f;    // Output hiss low-pass
+  float output_lp_coeff_ = 0.3f;
+  float dc_in_ = 0.0f;       // DC blocker
+  float dc_out_ = 0.0f;
+  float dc_coeff_ = 0.99f;
+
+  // Step timing (the clock)
+  StepScheduler scheduler_;
+
+  // Tempo smoothing
+  float bpm_target_ = 120.0f;
+  float bpm_smooth_ = 120.0f;
+  float bpm_glide_rate_ = 0.0f;  // Log2 of the glide's decay per sample
+  float steps_per_beat_ = 2.0f;
+
+  // The pattern playing, and the ones waiting for the next bar
+  Pattern pattern_;
+  bool has_pattern_ = false;
+  SpscQueue<Pattern, 2> pattern_queue_;
+  PatternGenerator generator_;  // For GenerateSequence()
+  int current_step_ = 0;
+
+  // LFO rates
+  float lfo_freq_ = 0.2f;
+  float lfo2_freq_ = 3.0f;
+
+  // Modulation routing, evaluated every CONTROL_INTERVAL samples
+  ModMatrix matrix_;
+  SpscQueue<RouteEvent, ROUTE_QUEUE_SIZE> route_queue_;
+  size_t control_left_ = 0;    // Samples until the next evaluation
+  float note_step_ = 0.0f;     // MOD_SRC_STEP
+  float delay_mod_ = 0.0f;     // MOD_DEST_DELAY_TIME of the newest voice
+  float bitcrush_mod_ = 0.0f;  // MOD_DEST_BITCRUSH_RATE of the newest voice
+
+  // Per-block scratch buffers
+  StepEvent step_events_[MAX_STEP_EVENTS];
+  int num_step_events_ = 0;
+  float cutoff_buf_[MAX_BLOCK_SIZE];  // Smoothed cutoff before modulation
+  float bend_buf_[MAX_BLOCK_SIZE];    // Pitch bend frequency ratio
+  float oversampled_buf_[MAX_BLOCK_SIZE * Oversampler::MAX_FACTOR];
+  float crushed_buf_[MAX_BLOCK_SIZE * Oversampler::MAX_FACTOR];  // While bitcrush fades
+};
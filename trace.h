@@ -0,0 +1,110 @@
+// Event tracing from the audio callback and the control loop.
+//
+// Each writer has its own TraceBuffer, a ring of fixed-size binary records
+// on the SpscQueue, so writing one is a couple of index loads, a 12-byte
+// copy and a store: no locks, no formatting and nothing that can block.
+// When a ring is full the record is dropped and counted instead. Every
+// record is stamped with the sample clock, so records from different rings
+// line up.
+//
+// Nothing is sent from the writers. The main loop drains the rings when it
+// is otherwise idle and sends batches over USB serial, a batch at a time and
+// only once the last one has gone; the host tools write them to a file.
+//
+// Build with -DKIDSYNTH_TRACE=0 (make TRACE=0) to compile it out; Write()
+// is then empty, the rings have no storage and reading finds nothing.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "spsc_queue.h"
+
+#ifndef KIDSYNTH_TRACE
+#define KIDSYNTH_TRACE 1
+#endif
+
+enum TraceEvent {
+  TRACE_STEP,      // arg: step, value: note frequency, 0 for a rest
+  TRACE_ENVELOPE,  // arg: voice, value: VoicePool::EnvStage entered
+  TRACE_PARAM,     // arg: the engine's ParamId, value: the new setting
+  TRACE_OVERRUN,   // value: the callback's load, over 1
+  TRACE_BUTTON,    // arg: button, value: 1 pressed, 0 released
+  NUM_TRACE_EVENTS
+};
+
+inline const char* TraceEventName(int event) {
+  static const char* const kNames[NUM_TRACE_EVENTS] = {
+    "step", "envelope", "param", "overrun", "button",
+  };
+  return event >= 0 && event < NUM_TRACE_EVENTS ? kNames[event] : "?";
+}
+
+struct TraceRecord {
+  uint32_t time;  // Sample clock, see KidSynth::SampleClock()
+  uint8_t event;  // TraceEvent
+  uint8_t arg;
+  uint16_t reserved;
+  float value;
+};
+
+// What goes over USB: a header, then count records
+struct TraceBatch {
+  static constexpr uint32_t MAGIC = 0x5254534bu;  // "KSTR"
+  static constexpr int MAX_RECORDS = 32;
+
+  uint32_t magic;
+  uint16_t count;
+  uint16_t dropped;  // Records lost to full rings since the last batch
+  TraceRecord records[MAX_RECORDS];
+
+  size_t Bytes() const { return sizeof(TraceBatch) - (MAX_RECORDS - count) * sizeof(TraceRecord); }
+};
+
+template <size_t CAPACITY>
+class TraceBuffer {
+ public:
+  // Writer side
+  void Write(uint32_t time, TraceEvent event, int arg, float value) {
+#if KIDSYNTH_TRACE
+    if (!records_.Push({time, static_cast<uint8_t>(event), static_cast<uint8_t>(arg), 0, value})) {
+      dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+#endif
+  }
+
+  // Reader side: the oldest record, if there is one
+  bool Read(TraceRecord& record) {
+#if KIDSYNTH_TRACE
+    const TraceRecord* next = records_.Peek();
+    if (!next) {
+      return false;
+    }
+    record = *next;
+    records_.Pop();
+    return true;
+#else
+    (void)record;
+    return false;
+#endif
+  }
+
+  // Reader side: records dropped since the last call
+  uint32_t TakeDropped() {
+#if KIDSYNTH_TRACE
+    const uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+    const uint32_t taken = dropped - dropped_taken_;
+    dropped_taken_ = dropped;
+    return taken;
+#else
+    return 0;
+#endif
+  }
+
+#if KIDSYNTH_TRACE
+ private:
+  SpscQueue<TraceRecord, CAPACITY> records_;  // The writer pushes, the reader pops
+  std::atomic<uint32_t> dropped_{0};  // Written by the writer only
+  uint32_t dropped_taken_ = 0;        // Reader only
+#endif
+};
@@ -0,0 +1,295 @@
+#include "voice_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "fast_math.h"
+#include "memory_placement.h"
+#include "pitch.h"
+#include "zdf_filter.h"
+
+namespace {
+constexpr int V = VoicePool::MAX_VOICES;
+constexpr float kSubAmp = 0.06f;  // Sub-bass level
+}  // namespace
+
+void VoicePool::Init(float sample_rate) {
+  Wavetable::Build();
+  inv_sample_rate_ = 1.0f / sample_rate;
+  pi_over_sr_ = static_cast<float>(M_PI) / sample_rate;
+  // Safe audible range, and within FastTan's accurate range
+  fc_max_ = std::min(12000.0f, sample_rate / 3.0f);
+  note_counter_ = 0;
+  newest_ = 0;
+  for (int v = 0; v < V; v++) {
+    freq_[v] = 0.0f;
+    phase_[v] = 0;
+    phase2_[v] = 0;
+    phase3_[v] = 0;
+    env_[v] = 0.0f;
+    held_[v] = 0.0f;
+    stage_[v] = ENV_IDLE;
+    velocity_[v] = 0.0f;
+    ic1eq_[v] = 0.0f;
+    ic2eq_[v] = 0.0f;
+    started_[v] = 0;
+  }
+  // No modulation until the first targets are set
+  for (int m = 0; m < NUM_VOICE_MODS; m++) {
+    const float none = (m == MOD_PITCH || m == MOD_AMP || m == MOD_DRIVE) ? 1.0f : 0.0f;
+    for (int v = 0; v < V; v++) {
+      mod_target_[m][v] = none;
+    }
+  }
+  EndModRamps();
+}
+
+void VoicePool::SetVoiceCount(int count) {
+  voice_count_ = std::min(std::max(count, 1), V);
+  for (int v = voice_count_; v < V; v++) {
+    if (stage_[v] != ENV_IDLE) {
+      stage_[v] = ENV_RELEASE;
+    }
+  }
+}
+
+void VoicePool::NoteOn(float freq, float velocity) {
+  // A free voice if there is one
+  int voice = -1;
+  for (int v = 0; v < voice_count_ && voice < 0; v++) {
+    if (stage_[v] == ENV_IDLE) {
+      voice = v;
+    }
+  }
+  // Otherwise the quietest voice that is already fading out
+  if (voice < 0) {
+    float quietest = 2.0f;
+    for (int v = 0; v < voice_count_; v++) {
+      if (stage_[v] == ENV_RELEASE && env_[v] < quietest) {
+        quietest = env_[v];
+        voice = v;
+      }
+    }
+  }
+  // Otherwise the oldest
+  if (voice < 0) {
+    uint32_t oldest = 0;
+    for (int v = 0; v < voice_count_; v++) {
+      uint32_t age = note_counter_ - started_[v];
+      if (age >= oldest) {
+        oldest = age;
+        voice = v;
+      }
+    }
+  }
+
+  // Phase, filter state and envelope level carry on, so a stolen voice is
+  // retriggered without a click
+  freq_[voice] = freq;
+  velocity_[voice] = velocity;
+  stage_[voice] = ENV_ATTACK;
+  held_[voice] = 0.0f;
+  started_[voice] = note_counter_++;
+  newest_ = voice;
+}
+
+void VoicePool::SetModTargets(const float (*targets)[MAX_VOICES], size_t samples) {
+  const float scale = 1.0f / samples;
+  for (int m = 0; m < NUM_VOICE_MODS; m++) {
+    for (int v = 0; v < V; v++) {
+      mod_target_[m][v] = targets[m][v];
+      mod_inc_[m][v] = (targets[m][v] - mod_[m][v]) * scale;
+    }
+  }
+  mod_left_ = samples;
+}
+
+void VoicePool::EndModRamps() {
+  // Land exactly on the targets rather than wherever rounding left the ramps
+  for (int m = 0; m < NUM_VOICE_MODS; m++) {
+    for (int v = 0; v < V; v++) {
+      mod_[m][v] = mod_target_[m][v];
+      mod_inc_[m][v] = 0.0f;
+    }
+  }
+  mod_left_ = 0;
+}
+
+int VoicePool::ActiveVoices() const {
+  int active = 0;
+  for (int v = 0; v < V; v++) {
+    active += stage_[v] != ENV_IDLE ? 1 : 0;
+  }
+  return active;
+}
+
+// BLOCK PASSES //
+//
+// Every pass runs all MAX_VOICES lanes in its inner loop, sounding or not,
+// so the loops have a fixed trip count and no per-voice branches.
+
+KIDSYNTH_ITCM void VoicePool::OscillatorPass(const Params& params, const float* bend, size_t size) {
+  const Wavetable::Wave wave = params.wave;
+  const float osc_amp = params.osc_amp;
+  const float osc2_amp = params.osc2_amp;
+  const float osc2_scale = params.osc2_ratio * inv_sample_rate_;
+  const float* pitch_inc = mod_inc_[MOD_PITCH];
+  const float* drive_inc = mod_inc_[MOD_DRIVE];
+  // The sub oscillator's loop below ramps its own copy from the same start
+  float pitch[V], drive[V];
+  std::copy(mod_[MOD_PITCH], mod_[MOD_PITCH] + V, pitch);
+  std::copy(mod_[MOD_DRIVE], mod_[MOD_DRIVE] + V, drive);
+  for (size_t i = 0; i < size; i++) {
+    const float bend_i = bend[i];
+    float* osc = osc_buf_ + i * V;
+    float* osc2 = osc2_buf_ + i * V;
+    for (int v = 0; v < V; v++) {
+      pitch[v] += pitch_inc[v];
+      drive[v] += drive_inc[v];
+      // Phases wrap on their own as the accumulators overflow
+      const float freq = freq_[v] * bend_i * pitch[v];
+      const uint32_t inc = Wavetable::PhaseIncrement(freq * inv_sample_rate_);
+      osc[v] = Wavetable::Read(wave, phase_[v], inc) * osc_amp * drive[v];
+      phase_[v] += inc;
+
+      const uint32_t inc2 = Wavetable::PhaseIncrement(freq * osc2_scale);
+      osc2[v] = Wavetable::Read(wave, phase2_[v], inc2) * osc2_amp * drive[v];
+      phase2_[v] += inc2;
+    }
+  }
+
+  if (params.sub) {
+    const float sub_scale = kSubOctaveRatio * inv_sample_rate_;
+    std::copy(mod_[MOD_PITCH], mod_[MOD_PITCH] + V, pitch);
+    std::copy(mod_[MOD_DRIVE], mod_[MOD_DRIVE] + V, drive);
+    for (size_t i = 0; i < size; i++) {
+      const float bend_i = bend[i];
+      float* osc3 = osc3_buf_ + i * V;
+      for (int v = 0; v < V; v++) {
+        pitch[v] += pitch_inc[v];
+        drive[v] += drive_inc[v];
+        const uint32_t inc3 = Wavetable::PhaseIncrement(freq_[v] * bend_i * pitch[v] * sub_scale);
+        osc3[v] = Wavetable::Read(Wavetable::WAVE_SQUARE, phase3_[v], inc3) * kSubAmp * drive[v];
+        phase3_[v] += inc3;
+      }
+    }
+  }
+
+  for (int v = 0; v < V; v++) {
+    mod_[MOD_PITCH][v] += pitch_inc[v] * size;
+    mod_[MOD_DRIVE][v] += drive_inc[v] * size;
+  }
+}
+
+KIDSYNTH_ITCM void VoicePool::MixPass(const Params& params, size_t size) {
+  // Apply consistent drive to all waveforms
+  const float osc_drive = 2.0f;
+  const size_t n = size * V;
+  SaturateBlock(params.curve, osc_buf_, osc_buf_, n, osc_drive);
+
+  // Add in detune osc with level compensation to prevent clipping
+  if (params.detune_gain > 0.0f) {
+    SaturateBlock(params.curve, osc2_buf_, osc2_buf_, n, osc_drive);
+    const float dry_gain = params.dry_gain;
+    const float detune_gain = params.detune_gain;
+    for (size_t j = 0; j < n; j++) {
+      osc_buf_[j] = (osc_buf_[j] * dry_gain) + (osc2_buf_[j] * detune_gain);
+    }
+  }
+
+  // Add sub-bass only in saw+sub mode
+  if (params.sub) {
+    SaturateBlock(params.curve, osc3_buf_, osc3_buf_, n, osc_drive);
+    for (size_t j = 0; j < n; j++) {
+      osc_buf_[j] = osc_buf_[j] * 0.7f + osc3_buf_[j] * 0.5f;
+    }
+  }
+}
+
+KIDSYNTH_ITCM void VoicePool::VoiceFilterAmpPass(const Params& params, const float* cutoff, float* out, size_t size) {
+  const float attack_inc = params.attack_inc;
+  const float release_dec = params.release_dec;
+  const float sustain_samples = params.sustain_samples;
+  const float resonance = params.resonance;
+  float* cutoff_mod = mod_[MOD_CUTOFF];
+  float* res_mod = mod_[MOD_RESONANCE];
+  float* amp_mod = mod_[MOD_AMP];
+  const float* cutoff_inc = mod_inc_[MOD_CUTOFF];
+  const float* res_inc = mod_inc_[MOD_RESONANCE];
+  const float* amp_inc = mod_inc_[MOD_AMP];
+  for (size_t i = 0; i < size; i++) {
+    const float cutoff_i = cutoff[i];
+    const float* in = osc_buf_ + i * V;
+    float voice_out[V];
+    for (int v = 0; v < V; v++) {
+      // Envelope: linear attack to 1, hold for the sustain time, linear
+      // release to 0
+      const int32_t stage = stage_[v];
+      float env = env_[v];
+      float held = held_[v];
+      env += stage == ENV_ATTACK ? attack_inc : (stage == ENV_RELEASE ? -release_dec : 0.0f);
+      held = stage == ENV_SUSTAIN ? held + 1.0f : held;
+      // Bitwise & rather than && keeps these branch-free
+      const bool peaked = (stage == ENV_ATTACK) & (env >= 1.0f);
+      const bool hold_done = (stage == ENV_SUSTAIN) & (held >= sustain_samples);
+      const bool faded = (stage == ENV_RELEASE) & (env <= 0.0f);
+      env = peaked ? 1.0f : (faded ? 0.0f : env);
+      held = peaked ? 0.0f : held;
+      int32_t next = peaked ? ENV_SUSTAIN : stage;
+      next = hold_done ? ENV_RELEASE : next;
+      next = faded ? ENV_IDLE : next;
+      env_[v] = env;
+      held_[v] = held;
+      stage_[v] = next;
+
+      // Cutoff and resonance with whatever the matrix routes to them
+      cutoff_mod[v] += cutoff_inc[v];
+      res_mod[v] += res_inc[v];
+      amp_mod[v] += amp_inc[v];
+      const float fc = FastClamp(cutoff_i + cutoff_mod[v], 20.0f, fc_max_);
+      const float res = FastClamp(resonance + res_mod[v], 0.1f, 0.98f);
+      // Idle voices are held at exactly zero; left to decay, their filter
+      // state would sink into denormals
+      const bool idle = next == ENV_IDLE;
+      float ic1eq = idle ? 0.0f : ic1eq_[v];
+      float ic2eq = idle ? 0.0f : ic2eq_[v];
+      float band;
+      const float low = ZdfTick(idle ? 0.0f : in[v], FastTan(fc * pi_over_sr_), ZdfDamping(res), ZdfDrive(res),
+                                ic1eq, ic2eq, band);
+      ic1eq_[v] = ic1eq;
+      ic2eq_[v] = ic2eq;
+
+      // Amp with per-note velocity
+      const float amp = env * velocity_[v] * amp_mod[v];
+      // Noise gate: fade to zero below threshold
+      const float gate = env < 0.005f ? env * 200.0f : 1.0f;
+      voice_out[v] = low * amp * gate;
+    }
+    float sum = 0.0f;
+    for (int v = 0; v < V; v++) {
+      sum += voice_out[v];
+    }
+    out[i] = sum;
+  }
+}
+
+KIDSYNTH_ITCM void VoicePool::Render(const Params& params, const float* bend, const float* cutoff, float* out,
+                                     size_t size) {
+  // Split where the modulation ramps end, so they stop on their targets
+  while (size > 0) {
+    const size_t n = mod_left_ > 0 ? std::min(size, mod_left_) : size;
+    OscillatorPass(params, bend, n);
+    MixPass(params, n);
+    VoiceFilterAmpPass(params, cutoff, out, n);
+    if (mod_left_ > 0) {
+      mod_left_ -= n;
+      if (mod_left_ == 0) {
+        EndModRamps();
+      }
+    }
+    bend += n;
+    cutoff += n;
+    out += n;
+    size -= n;
+  }
+}
@@ -0,0 +1,123 @@
+// Preallocated pool of synth voices.
+//
+// Each voice is the wavetable oscillator trio, its drive and mix, an
+// envelope, and a ZDF low-pass, summed after the per-voice amp. Voice state
+// is kept as structure-of-arrays, one lane per voice, so every pass over the
+// block runs all voices in the same inner loop. Idle voices are simply silent
+// lanes; nothing is allocated after Init().
+//
+// Notes start with NoteOn(). A free voice is used if there is one,
+// otherwise the quietest releasing voice, otherwise the oldest voice is
+// retriggered from its current level so there is no click. With one voice
+// this is the original monophonic behaviour.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "saturation.h"
+#include "wavetable.h"
+
+class VoicePool {
+ public:
+  static constexpr int MAX_VOICES = 8;
+  static constexpr size_t MAX_BLOCK_SIZE = 256;
+
+  enum EnvStage {
+    ENV_IDLE,
+    ENV_ATTACK,
+    ENV_SUSTAIN,
+    ENV_RELEASE
+  };
+
+  // Per-voice modulation, set by the modulation matrix
+  enum VoiceMod {
+    MOD_PITCH,      // Frequency ratio
+    MOD_CUTOFF,     // Added to the cutoff, Hz
+    MOD_RESONANCE,  // Added to the resonance
+    MOD_AMP,        // Level multiplier
+    MOD_DRIVE,      // Oscillator drive multiplier
+    NUM_VOICE_MODS
+  };
+
+  // Settings shared by every voice, fixed for one Render() call
+  struct Params {
+    float osc_amp;           // First oscillator level
+    float osc2_amp;          // Second oscillator level
+    Wavetable::Wave wave;    // Waveform of both main oscillators
+    float osc2_ratio;        // Second oscillator interval
+    float dry_gain;          // First oscillator gain in the mix
+    float detune_gain;       // Second oscillator gain in the mix
+    bool sub;                // Mix in the sub-bass oscillator
+    float resonance;         // 0-1 before LFO modulation
+    float attack_inc;        // Envelope rise per sample
+    float release_dec;       // Envelope fall per sample
+    float sustain_samples;   // Time held at full level
+    SaturationCurve curve;   // Oscillator drive curve
+  };
+
+  void Init(float sample_rate);
+
+  // Number of voices notes are allocated to, 1 to MAX_VOICES. Voices above
+  // the new count are released.
+  void SetVoiceCount(int count);
+  int VoiceCount() const { return voice_count_; }
+
+  void NoteOn(float freq, float velocity);
+
+  // New modulation targets, targets[mod][voice]. Each voice's modulation
+  // ramps there linearly over the next samples samples, then holds.
+  void SetModTargets(const float (*targets)[MAX_VOICES], size_t samples);
+
+  // Renders size (up to MAX_BLOCK_SIZE) samples of all voices, summed into
+  // out. bend holds the pitch bend ratio and cutoff the smoothed cutoff in
+  // Hz, one value per sample.
+  void Render(const Params& params, const float* bend, const float* cutoff, float* out, size_t size);
+
+  // Modulation sources, one lane per voice
+  const float* Envelopes() const { return env_; }
+  const float* Velocities() const { return velocity_; }
+  // The voice of the latest note, for modulation that isn't per voice
+  int NewestVoice() const { return newest_; }
+  EnvStage Stage(int voice) const { return static_cast<EnvStage>(stage_[voice]); }
+
+  // Voices currently sounding
+  int ActiveVoices() const;
+
+ private:
+  friend struct KernelBench;
+
+  void OscillatorPass(const Params& params, const float* bend, size_t size);
+  void MixPass(const Params& params, size_t size);
+  void VoiceFilterAmpPass(const Params& params, const float* cutoff, float* out, size_t size);
+  void EndModRamps();
+
+  float inv_sample_rate_ = 1.0f / 48000.0f;
+  float pi_over_sr_ = 0.0f;
+  float fc_max_ = 12000.0f;
+  int voice_count_ = MAX_VOICES;
+  uint32_t note_counter_ = 0;
+  int newest_ = 0;
+
+  // Voice state, one lane per voice
+  float freq_[MAX_VOICES];     // Unbent base frequency
+  uint32_t phase_[MAX_VOICES];  // Oscillator phase accumulators
+  uint32_t phase2_[MAX_VOICES];
+  uint32_t phase3_[MAX_VOICES];
+  float env_[MAX_VOICES];
+  float held_[MAX_VOICES];     // Samples spent in sustain
+  int32_t stage_[MAX_VOICES];  // EnvStage
+  float velocity_[MAX_VOICES];
+  float ic1eq_[MAX_VOICES];    // Filter state
+  float ic2eq_[MAX_VOICES];
+  uint32_t started_[MAX_VOICES];  // note_counter_ at NoteOn, for stealing
+  float mod_[NUM_VOICE_MODS][MAX_VOICES];         // Current modulation
+  float mod_target_[NUM_VOICE_MODS][MAX_VOICES];  // Where the ramps end
+  float mod_inc_[NUM_VOICE_MODS][MAX_VOICES];     // Per-sample ramp
+  size_t mod_left_ = 0;                           // Samples until the ramps end
+
+  // Per-block scratch, sample-major: sample i of voice v is at
+  // [i * MAX_VOICES + v]
+  float osc_buf_[MAX_BLOCK_SIZE * MAX_VOICES];
+  float osc2_buf_[MAX_BLOCK_SIZE * MAX_VOICES];
+  float osc3_buf_[MAX_BLOCK_SIZE * MAX_VOICES];
+};
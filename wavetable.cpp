@@ -0,0 +1,73 @@
+#include "wavetable.h"
+
+#include <cmath>
+
+#include "memory_placement.h"
+
+// About 120KB: too big for the Seed's internal SRAM, so there the tables
+// live in SDRAM, which hw.Init() brings up before the engine is initialized
+float KIDSYNTH_SDRAM_BSS Wavetable::tables_[NUM_WAVES][NUM_LEVELS][TABLE_SIZE + 1];
+
+void Wavetable::Build() {
+  // Function-local static: generated exactly once, even with several
+  // engines starting on different threads
+  static const bool built = (Generate(), true);
+  (void)built;
+}
+
+void Wavetable::Generate() {
+  // Every harmonic of a table-length cycle lands exactly on an entry of a
+  // single sine table, so the additive synthesis below needs no sinf
+  static float sine[TABLE_SIZE];
+  for (size_t i = 0; i < TABLE_SIZE; i++) {
+    sine[i] = sinf(2.0f * static_cast<float>(M_PI) * i / TABLE_SIZE);
+  }
+
+  const float pi = static_cast<float>(M_PI);
+  for (int wave = 0; wave < NUM_WAVES; wave++) {
+    // Build from the top level down: each level is the one above it plus
+    // the harmonics it adds
+    int harmonics = 0;
+    for (int level = NUM_LEVELS - 1; level >= 0; level--) {
+      float* table = tables_[wave][level];
+      if (level == NUM_LEVELS - 1) {
+        for (size_t i = 0; i < TABLE_SIZE; i++) {
+          table[i] = 0.0f;
+        }
+      } else {
+        const float* above = tables_[wave][level + 1];
+        for (size_t i = 0; i < TABLE_SIZE; i++) {
+          table[i] = above[i];
+        }
+      }
+
+      int top = 1 << (TABLE_BITS - 1 - level);
+      if (top >= static_cast<int>(TABLE_SIZE / 2)) {
+        top = TABLE_SIZE / 2 - 1;
+      }
+      for (int k = harmonics + 1; k <= top; k++) {
+        float amp = 0.0f;
+        switch (wave) {
+          case WAVE_SAW:
+            amp = 2.0f / (pi * k);
+            break;
+          case WAVE_SQUARE:
+            amp = k % 2 ? 4.0f / (pi * k) : 0.0f;
+            break;
+          case WAVE_TRIANGLE:
+            // Odd harmonics with alternating signs: rises from 0 at phase 0
+            amp = k % 2 ? ((k / 2) % 2 ? -8.0f : 8.0f) / (pi * pi * k * k) : 0.0f;
+            break;
+        }
+        if (amp == 0.0f) {
+          continue;
+        }
+        for (size_t i = 0; i < TABLE_SIZE; i++) {
+          table[i] += amp * sine[(k * i) & (TABLE_SIZE - 1)];
+        }
+      }
+      harmonics = top;
+      table[TABLE_SIZE] = table[0];
+    }
+  }
+}
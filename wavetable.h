@@ -0,0 +1,66 @@
+// Band-limited wavetables for the voice oscillators.
+//
+// Each waveform is stored as a set of mip levels, one per octave, each
+// holding only the harmonics that stay below Nyquist for the pitches it is
+// used at. Oscillators keep a 32-bit phase accumulator: the top TABLE_BITS
+// index the table and the rest interpolate between entries. The level is
+// picked from the phase increment, so cost is the same for every waveform
+// and pitch, and bending a note up doesn't alias.
+//
+// The tables are built once, on first use, by Build().
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class Wavetable {
+ public:
+  enum Wave {
+    WAVE_SAW,       // Falling ramp, +1 to -1
+    WAVE_SQUARE,    // +1 for the first half cycle, -1 for the second
+    WAVE_TRIANGLE,  // Rises from 0 to +1 over the first quarter cycle
+    NUM_WAVES
+  };
+
+  static constexpr int TABLE_BITS = 10;
+  static constexpr size_t TABLE_SIZE = 1 << TABLE_BITS;
+  // Level 0 holds TABLE_SIZE / 2 - 1 harmonics, each level up half as many
+  static constexpr int NUM_LEVELS = TABLE_BITS;
+
+  // Generates every table; safe to call more than once or from several
+  // threads
+  static void Build();
+
+  // Phase increment for a frequency in cycles per sample (Hz / sample
+  // rate), in 2^32 steps per cycle. Capped at Nyquist.
+  static uint32_t PhaseIncrement(float cycles_per_sample) {
+    float inc = cycles_per_sample < 0.0f ? 0.0f : (cycles_per_sample > 0.5f ? 0.5f : cycles_per_sample);
+    return static_cast<uint32_t>(inc * 4294967296.0f);
+  }
+
+  // Interpolated sample at phase, from the level for phase increment inc
+  static float Read(Wave wave, uint32_t phase, uint32_t inc) {
+    const float* table = tables_[wave][Level(inc)];
+    const uint32_t index = phase >> kFracBits;
+    const float frac = static_cast<float>(phase & kFracMask) * (1.0f / (kFracMask + 1));
+    const float a = table[index];
+    const float b = table[index + 1];
+    return a + (b - a) * frac;
+  }
+
+ private:
+  static constexpr int kFracBits = 32 - TABLE_BITS;
+  static constexpr uint32_t kFracMask = (1u << kFracBits) - 1;
+
+  // Level l holds 2^(TABLE_BITS - 1 - l) harmonics (less one at level 0),
+  // which stay under Nyquist for increments below 2^(kFracBits + l)
+  static int Level(uint32_t inc) {
+    const int bits = 32 - __builtin_clz(inc | 1);
+    const int level = bits - kFracBits;
+    return level < 0 ? 0 : (level > NUM_LEVELS - 1 ? NUM_LEVELS - 1 : level);
+  }
+
+  static void Generate();
+
+  // One guard sample per table so interpolation never wraps
+  static float tables_[NUM_WAVES][NUM_LEVELS][TABLE_SIZE + 1];
+};
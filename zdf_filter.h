@@ -0,0 +1,42 @@
+// Zero-delay-feedback state-variable filter.
+//
+// The pieces of a trapezoidal (TPT) SVF, for the voice pool to run across
+// its lanes of filter state. The coefficients are cheap enough to
+// recompute every sample: the cutoff is prewarped with FastTan() instead
+// of sinf and the damping needs two square roots instead of powf. That
+// makes audio-rate cutoff modulation (LFO, envelope, filter FM)
+// affordable.
+//
+// Resonance uses the same 0-1 scale and damping curve as daisysp::Svf, and
+// the band-pass state is softly limited the way Svf's drive term does, so
+// high resonance settings ring but stay bounded.
+#pragma once
+#include <cmath>
+
+#include "fast_math.h"
+
+// Damping for a 0-1 resonance: 2 * (1 - res^0.25), as in daisysp::Svf
+inline float ZdfDamping(float res) {
+  res = FastClamp(res, 0.0f, 1.0f);
+  return 2.0f * (1.0f - sqrtf(sqrtf(res)));
+}
+
+// Band-pass limiting for a 0-1 resonance; Svf applies 0.5 * res twice per
+// sample
+inline float ZdfDrive(float res) { return FastClamp(res, 0.0f, 1.0f); }
+
+// One sample of the filter on the state pair ic1eq/ic2eq, for prewarped
+// cutoff g. Returns the low-pass output and leaves the band-pass in band.
+inline float ZdfTick(float in, float g, float k, float drive, float& ic1eq, float& ic2eq, float& band) {
+  float a1 = 1.0f / (1.0f + g * (g + k));
+  float v3 = in - ic2eq;
+  float v1 = a1 * (ic1eq + g * v3);
+  // Soft limit on the band-pass state, close to v1 - drive * v1^3 for
+  // small signals but bounded for large ones
+  v1 = v1 / (1.0f + drive * v1 * v1);
+  float v2 = ic2eq + g * v1;
+  ic1eq = 2.0f * v1 - ic1eq;
+  ic2eq = 2.0f * v2 - ic2eq;
+  band = v1;
+  return v2;
+}